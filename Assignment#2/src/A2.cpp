@@ -6,6 +6,18 @@
 #include <string>
 #include <algorithm>
 #include <iomanip>
+#include <array>
+#include <bitset>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cctype>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -74,172 +86,202 @@ void printGrammar(const Grammar& grammar, const string& title) {
     }
 }
 
-// Left factoring function
-Grammar applyLeftFactoring(const Grammar& original) {
-    Grammar result = original;
-    bool factored = false;
-    map<char, vector<vector<char>>> newProductions;
+// Prefix trie of the alternatives of one non-terminal. Children are kept in the
+// order they were first seen. Symbol '\0' marks that an alternative ends here
+struct PrefixTrie {
+    vector<vector<pair<char, int>>> children = {{}};  // Node 0 is the root
     
-    for (const auto& entry : result.productions) {
-        char nonTerminal = entry.first;
-        vector<vector<char>> productions = entry.second;
-        
-        // Check for common prefixes
-        for (size_t i = 0; i < productions.size(); i++) {
-            for (size_t j = i + 1; j < productions.size(); j++) {
-                // Find common prefix
-                size_t k = 0;
-                while (k < productions[i].size() && k < productions[j].size() && 
-                       productions[i][k] == productions[j][k]) {
-                    k++;
-                }
-                
-                if (k > 0) {  // Common prefix found
-                    factored = true;
-                    
-                    // Create a new non-terminal
-                    char newNonTerminal = 'Z';
-                    while (result.productions.find(newNonTerminal) != result.productions.end() ||
-                           newProductions.find(newNonTerminal) != newProductions.end()) {
-                        newNonTerminal--; // go back in the ASCII 
-                    }
-                    
-                    // Create production for the new non-terminal
-                    vector<vector<char>> newNonTerminalProductions;
-                    
-                    // Add the remaining parts of both productions
-                    vector<char> suffix1(productions[i].begin() + k, productions[i].end());
-                    vector<char> suffix2(productions[j].begin() + k, productions[j].end());
-                    
-                    // If a suffix is empty, make it epsilon
-                    if (suffix1.empty()) suffix1.push_back('e');
-                    if (suffix2.empty()) suffix2.push_back('e');
-                    
-                    newNonTerminalProductions.push_back(suffix1);
-                    newNonTerminalProductions.push_back(suffix2);
-                    
-                    // Update the original non-terminal's production
-                    vector<char> prefix(productions[i].begin(), productions[i].begin() + k);
-                    prefix.push_back(newNonTerminal);
-                    
-                    // Remove the two original productions
-                    productions.erase(productions.begin() + j);
-                    productions.erase(productions.begin() + i);
-                    
-                    // Add the new production
-                    productions.push_back(prefix);
-                    
-                    // Store the new non-terminal and its productions
-                    newProductions[newNonTerminal] = newNonTerminalProductions;
-                    
-                    // Reset to check all pairs again
-                    i = -1;
-                    break;
-                }
+    void insert(const vector<char>& production) {
+        int node = 0;
+        bool epsilon = production.size() == 1 && production[0] == 'e';
+        for (size_t i = 0; i <= production.size(); i++) {
+            char symbol = (i == production.size() || epsilon) ? '\0' : production[i];
+            int child = -1;
+            for (const auto& edge : children[node]) {
+                if (edge.first == symbol) child = edge.second;
+            }
+            if (child == -1) {
+                child = children.size();
+                children[node].push_back({symbol, child});
+                children.emplace_back();
             }
+            if (symbol == '\0') return;
+            node = child;
+        }
+    }
+};
+
+// Pick a fresh non-terminal, counting down from Z and skipping used letters.
+// Single characters only give 26 names, so stop with an error when they run out
+char makeFreshNonTerminal(set<char>& used) {
+    for (char c = 'Z'; c >= 'A'; c--) {
+        if (used.insert(c).second) return c;
+    }
+    cerr << "Error: no free non-terminal letters left for left factoring" << endl;
+    exit(1);
+}
+
+// Build the alternatives for the part of the trie under node. A path without
+// branches is kept as it is; where it branches, a new non-terminal takes the suffixes
+void factorTrieNode(const PrefixTrie& trie, int node, vector<vector<char>>& alternatives,
+                    map<char, vector<vector<char>>>& newProductions, set<char>& used) {
+    for (const auto& edge : trie.children[node]) {
+        if (edge.first == '\0') {  // An alternative ends here
+            alternatives.push_back({'e'});
+            continue;
+        }
+        
+        // Follow the path while it does not branch and nothing ends on it
+        vector<char> alternative = {edge.first};
+        int current = edge.second;
+        while (trie.children[current].size() == 1 && trie.children[current][0].first != '\0') {
+            alternative.push_back(trie.children[current][0].first);
+            current = trie.children[current][0].second;
         }
         
-        result.productions[nonTerminal] = productions;
+        if (trie.children[current].size() > 1) {  // Common prefix, factor it
+            char newNonTerminal = makeFreshNonTerminal(used);
+            alternative.push_back(newNonTerminal);
+            vector<vector<char>> suffixes;
+            factorTrieNode(trie, current, suffixes, newProductions, used);
+            newProductions[newNonTerminal] = suffixes;
+        }
+        alternatives.push_back(alternative);
+    }
+}
+
+// Left factoring function. The alternatives of every non-terminal go into a
+// prefix trie, and all alternatives sharing a prefix are factored together,
+// recursively down the trie, in a single pass. Grammar is changed in place
+void applyLeftFactoring(Grammar& grammar) {
+    bool factored = false;
+    map<char, vector<vector<char>>> newProductions;
+    
+    set<char> used;
+    for (const auto& entry : grammar.productions) {
+        used.insert(entry.first);
+        for (const auto& production : entry.second) {
+            used.insert(production.begin(), production.end());
+        }
     }
     
-    // Add all new productions to the result
-    for (const auto& entry : newProductions) {
-        result.productions[entry.first] = entry.second;
+    for (auto& entry : grammar.productions) {
+        PrefixTrie trie;
+        for (const auto& production : entry.second) {
+            trie.insert(production);
+        }
+        
+        vector<vector<char>> productions;
+        size_t before = newProductions.size();
+        factorTrieNode(trie, 0, productions, newProductions, used);
+        if (newProductions.size() != before) {
+            factored = true;
+            entry.second = move(productions);
+        }
     }
     
+    // Add all new productions, fresh names so no key is taken already
+    grammar.productions.merge(newProductions);
+    
     if (factored) {
         cout << "\nLeft factoring was applied." << endl;
     } else {
         cout << "\nNo left factoring needed." << endl;
     }
-    
-    return result;
 }
 
-//depth firts search for each elemment in first set
-bool calculateFirstDFS(char symbol, char original, char last, 
-                     const map<char, vector<vector<char>>>& productions,
-                     set<char>& firstSet) {
-    if (!(symbol >= 'A' && symbol <= 'Z')) {
-        // If terminal or epsilon
-        firstSet.insert(symbol);
-        return symbol == 'e';
-    }
-    
-    bool canDeriveEpsilon = false;
-    
-    for (const auto& production : productions.at(symbol)) {
-        if (production.empty()) {
-            firstSet.insert('e');
-            canDeriveEpsilon = true;
-            continue;
+// Function to compute FIRST sets with a worklist. First find which non-terminals
+// can derive epsilon, then FIRST(B) flow into FIRST(A) along edge B -> A when B can
+// start a production of A. A non-terminal go back in worklist only when its set grow
+map<char, set<char>> computeFirstSets(const Grammar& grammar) {
+    auto isNonTerminal = [](char c) { return c >= 'A' && c <= 'Z'; };
+
+    // Flat list of productions with their left side
+    vector<pair<char, const vector<char>*>> productions;
+    for (const auto& entry : grammar.productions) {
+        for (const auto& production : entry.second) {
+            productions.push_back({entry.first, &production});
         }
-        
-        // Check if this production can derive epsilon
-        bool allCanDeriveEpsilon = true;
-        
-        for (size_t i = 0; i < production.size(); i++) {
-            char currentSymbol = production[i];
-            
-            // If it's the same non-terminal (left recursion), skip to avoid infinite loop
-            if (currentSymbol == symbol) {
-                allCanDeriveEpsilon = false;
-                break;
-            }
-            
-            // If terminal, add to FIRST set and stop
-            if (!(currentSymbol >= 'A' && currentSymbol <= 'Z')) {
-                firstSet.insert(currentSymbol);
-                allCanDeriveEpsilon = (currentSymbol == 'e');
-                break;
+    }
+
+    // Nullable: count non-terminals in each production not yet known nullable
+    bool nullable[256] = {};
+    vector<int> remaining(productions.size(), 0);
+    vector<vector<int>> usedIn(256);
+    vector<char> worklist;
+    for (size_t p = 0; p < productions.size(); p++) {
+        bool hasTerminal = false;
+        for (char symbol : *productions[p].second) {
+            if (isNonTerminal(symbol)) {
+                remaining[p]++;
+                usedIn[(unsigned char)symbol].push_back((int)p);
+            } else if (symbol != 'e') {
+                hasTerminal = true;
             }
-            
-            // Recursive call for non-terminal
-            set<char> tempFirst;
-            bool symbolCanDeriveEpsilon = calculateFirstDFS(currentSymbol, original, production.back(), 
-                                                         productions, tempFirst);
-            
-            // Add all terminals except epsilon to the FIRST set
-            for (char c : tempFirst) {
-                if (c != 'e') {
-                    firstSet.insert(c);
-                }
+        }
+        char lhs = productions[p].first;
+        if (hasTerminal) {
+            remaining[p] = -1;  // Never nullable
+        } else if (remaining[p] == 0 && !nullable[(unsigned char)lhs]) {
+            nullable[(unsigned char)lhs] = true;
+            worklist.push_back(lhs);
+        }
+    }
+    while (!worklist.empty()) {
+        char b = worklist.back();
+        worklist.pop_back();
+        for (int p : usedIn[(unsigned char)b]) {
+            char lhs = productions[p].first;
+            if (remaining[p] > 0 && --remaining[p] == 0 && !nullable[(unsigned char)lhs]) {
+                nullable[(unsigned char)lhs] = true;
+                worklist.push_back(lhs);
             }
-            
-            // If this symbol can't derive epsilon, we stop here
-            if (!symbolCanDeriveEpsilon) {
-                allCanDeriveEpsilon = false;
+        }
+    }
+
+    // Terminals that start a production directly, and the edges B -> A
+    vector<set<char>> first(256);
+    vector<set<char>> dependents(256);
+    for (const auto& p : productions) {
+        for (char symbol : *p.second) {
+            if (symbol == 'e') continue;
+            if (!isNonTerminal(symbol)) {
+                first[(unsigned char)p.first].insert(symbol);
                 break;
             }
-            
-            // If we're at the last symbol and it can derive epsilon, the whole production can derive epsilon
-            if (i == production.size() - 1 && symbolCanDeriveEpsilon) {
-                canDeriveEpsilon = true;
-            }
+            if (symbol != p.first) dependents[(unsigned char)symbol].insert(p.first);
+            if (!nullable[(unsigned char)symbol]) break;
         }
-        
-        // If all symbols in this production can derive epsilon, the whole non-terminal can
-        if (allCanDeriveEpsilon) {
-            firstSet.insert('e');
-            canDeriveEpsilon = true;
+    }
+
+    // Push sets along edges until nothing changes
+    bool queued[256] = {};
+    for (char c = 'A'; c <= 'Z'; c++) {
+        worklist.push_back(c);
+        queued[(unsigned char)c] = true;
+    }
+    while (!worklist.empty()) {
+        char b = worklist.back();
+        worklist.pop_back();
+        queued[(unsigned char)b] = false;
+        for (char a : dependents[(unsigned char)b]) {
+            set<char>& target = first[(unsigned char)a];
+            size_t before = target.size();
+            target.insert(first[(unsigned char)b].begin(), first[(unsigned char)b].end());
+            if (target.size() != before && !queued[(unsigned char)a]) {
+                queued[(unsigned char)a] = true;
+                worklist.push_back(a);
+            }
         }
     }
-    
-    return canDeriveEpsilon;
-}
 
-// Function to compute FIRST sets
-map<char, set<char>> computeFirstSets(const Grammar& grammar) {
     map<char, set<char>> firstSets;
-    
-    // For each non-terminal
     for (const auto& entry : grammar.productions) {
-        char nonTerminal = entry.first;
-        set<char> firstSet;
-        calculateFirstDFS(nonTerminal, nonTerminal, nonTerminal, grammar.productions, firstSet);
-        firstSets[nonTerminal] = firstSet;
+        set<char>& firstSet = first[(unsigned char)entry.first];
+        if (nullable[(unsigned char)entry.first]) firstSet.insert('e');
+        firstSets[entry.first] = firstSet;
     }
-    
+
     return firstSets;
 }
 
@@ -345,14 +387,14 @@ map<char, set<char>> computeFollowSets(const Grammar& grammar, const map<char, s
     return followSets;
 }
 
-// Function to detect and remove left recursion
-Grammar removeLeftRecursion(const Grammar& original) {
-    Grammar result = original;
+// Function to detect and remove left recursion, grammar is changed in place.
+// Productions are moved, not copied, when they stay as they are
+void removeLeftRecursion(Grammar& grammar) {
     bool hadLeftRecursion = false;
     
     // Create a vector of non-terminals in order
     vector<char> nonTerminals;
-    for (const auto& entry : result.productions) {
+    for (const auto& entry : grammar.productions) {
         nonTerminals.push_back(entry.first);
     }
     
@@ -365,43 +407,48 @@ Grammar removeLeftRecursion(const Grammar& original) {
         for (char Aj : nonTerminals) {
             if (Aj >= Ai) break;
             
+            vector<vector<char>>& aiProductions = grammar.productions[Ai];
+            bool startsWithAj = any_of(aiProductions.begin(), aiProductions.end(),
+                [Aj](const vector<char>& production) { return !production.empty() && production[0] == Aj; });
+            if (!startsWithAj) continue;  // Nothing to replace, leave it alone
+            
+            const vector<vector<char>>& ajProductions = grammar.productions[Aj];
             vector<vector<char>> newProductions;
             
             // Replace Ai -> Aj γ with Ai -> δ1 γ | δ2 γ | ... | δn γ
             // where Aj -> δ1 | δ2 | ... | δn
-            for (const auto& production : result.productions[Ai]) {
+            for (auto& production : aiProductions) {
                 if (!production.empty() && production[0] == Aj) {
-                    // This production starts with Aj
-                    vector<char> gamma(production.begin() + 1, production.end());
-                    
-                    // For each production Aj -> δ
-                    for (const auto& deltaProduction : result.productions[Aj]) {
-                        vector<char> newProduction = deltaProduction;
-                        newProduction.insert(newProduction.end(), gamma.begin(), gamma.end());
-                        newProductions.push_back(newProduction);
+                    // This production starts with Aj, γ is the rest of it
+                    for (const auto& deltaProduction : ajProductions) {
+                        vector<char> newProduction;
+                        newProduction.reserve(deltaProduction.size() + production.size() - 1);
+                        newProduction.insert(newProduction.end(), deltaProduction.begin(), deltaProduction.end());
+                        newProduction.insert(newProduction.end(), production.begin() + 1, production.end());
+                        newProductions.push_back(move(newProduction));
                     }
                 } else {
                     // Keep this production unchanged
-                    newProductions.push_back(production);
+                    newProductions.push_back(move(production));
                 }
             }
             
-            result.productions[Ai] = newProductions;
+            aiProductions = move(newProductions);
         }
         
         // Eliminate direct left recursion for Ai
         vector<vector<char>> alphaProductions;  // Ai -> Ai a
         vector<vector<char>> betaProductions;   // Ai -> β
         
-        for (const auto& production : result.productions[Ai]) {
+        for (auto& production : grammar.productions[Ai]) {
             if (!production.empty() && production[0] == Ai) {
-                // This is a left-recursive production
+                // This is a left-recursive production, keep only a
                 hadLeftRecursion = true;
-                vector<char> alpha(production.begin() + 1, production.end());
-                alphaProductions.push_back(alpha);
+                production.erase(production.begin());
+                alphaProductions.push_back(move(production));
             } else {
                 // This is not a left-recursive production
-                betaProductions.push_back(production);
+                betaProductions.push_back(move(production));
             }
         }
         
@@ -409,46 +456,42 @@ Grammar removeLeftRecursion(const Grammar& original) {
             // Create a new non-terminal Ai'
             char newNonTerminal = Ai;
             newNonTerminal = 'A' + nonTerminals.size();
-            while (result.productions.find(newNonTerminal) != result.productions.end()) {
+            while (grammar.productions.find(newNonTerminal) != grammar.productions.end()) {
                 newNonTerminal++;
             }
             
             // Replace Ai -> Ai a | β with
             // Ai -> β Ai'
             // Ai' -> a Ai' | e 
-            vector<vector<char>> newAiProductions;
-            vector<vector<char>> newAiPrimeProductions;
-            
-            for (const auto& beta : betaProductions) {
-                vector<char> newProduction = beta;
+            for (auto& beta : betaProductions) {
                 if (beta.size() == 1 && beta[0] == 'e') {
                     // If β is e , replace with Ai'
-                    newProduction = {newNonTerminal};
+                    beta = {newNonTerminal};
                 } else {
                     // Otherwise, append Ai' to β
-                    newProduction.push_back(newNonTerminal);
+                    beta.push_back(newNonTerminal);
                 }
-                newAiProductions.push_back(newProduction);
             }
             
             // If there are no β productions, add Ai -> Ai'
             if (betaProductions.empty()) {
-                newAiProductions.push_back({newNonTerminal});
+                betaProductions.push_back({newNonTerminal});
             }
             
-            for (const auto& alpha : alphaProductions) {
-                vector<char> newProduction = alpha;
-                newProduction.push_back(newNonTerminal);
-                newAiPrimeProductions.push_back(newProduction);
+            for (auto& alpha : alphaProductions) {
+                alpha.push_back(newNonTerminal);
             }
             
             // Add e  production for Ai'
-            newAiPrimeProductions.push_back({'e'});
+            alphaProductions.push_back({'e'});
             
             // Update the grammar
-            result.productions[Ai] = newAiProductions;
-            result.productions[newNonTerminal] = newAiPrimeProductions;
+            grammar.productions[Ai] = move(betaProductions);
+            grammar.productions[newNonTerminal] = move(alphaProductions);
             nonTerminals.push_back(newNonTerminal);
+        } else {
+            // No left recursion, put the productions back
+            grammar.productions[Ai] = move(betaProductions);
         }
     }
     
@@ -457,8 +500,6 @@ Grammar removeLeftRecursion(const Grammar& original) {
     } else {
         cout << "\nNo left recursion found." << endl;
     }
-    
-    return result;
 }
 
 // Function to print FIRST and FOLLOW sets
@@ -476,131 +517,493 @@ void printSets(const map<char, set<char>>& sets, const string& title) {
     }
 }
 
-// Function to construct LL(1) parsing table
-void constructLL1Table(const Grammar& grammar, 
-                       const map<char, set<char>>& firstSets, 
-                       const map<char, set<char>>& followSets) {
-    cout << "\nLL(1) Parsing Table:" << endl;
+// LL(1) parsing table. Each non-terminal has a row of 256 cells indexed directly by
+// the terminal character (as unsigned char), so a lookup costs the same for any alphabet
+struct LL1Table {
+    char startSymbol = 0;
+    vector<char> productionLhs;          // Production number -> its non-terminal
+    vector<vector<char>> productions;    // Production number -> right side
+    vector<char> nonTerminals;           // One per row, in grammar order
+    int rowOf[256];                      // Row of a non-terminal character, -1 if it has none
+    vector<array<int, 256>> rows;        // Production number for each character, -1 if empty
+    map<pair<int, int>, vector<int>> conflicts;  // (row, char) -> all productions of that cell
+    bitset<256> terminals;               // Terminals seen in FIRST or FOLLOW sets, '$' too
+    
+    int at(char nonTerminal, char terminal) const {
+        int row = rowOf[(unsigned char)nonTerminal];
+        return row < 0 ? -1 : rows[row][(unsigned char)terminal];
+    }
+    
+    // All productions in a cell; there is more than one only when there is a conflict
+    vector<int> cell(int row, int terminal) const {
+        auto found = conflicts.find({row, terminal});
+        if (found != conflicts.end()) return found->second;
+        int p = rows[row][terminal];
+        return p < 0 ? vector<int>() : vector<int>{p};
+    }
+    
+    string productionString(int p) const {
+        return string(1, productionLhs[p]) + "->" + string(productions[p].begin(), productions[p].end());
+    }
+};
+
+// Function to construct LL(1) parsing table. The FIRST set of each production is computed
+// once, and the production is then placed in the cell of every character in that set
+LL1Table constructLL1Table(const Grammar& grammar, 
+                           const map<char, set<char>>& firstSets, 
+                           const map<char, set<char>>& followSets) {
+    LL1Table table;
+    table.startSymbol = grammar.startSymbol;
+    fill(begin(table.rowOf), end(table.rowOf), -1);
     
     // Find all terminals in the grammar
-    set<char> terminals;
     for (const auto& entry : firstSets) {
         for (char terminal : entry.second) {
             if (terminal != 'e') {
-                terminals.insert(terminal);
+                table.terminals.set((unsigned char)terminal);
             }
         }
     }
     for (const auto& entry : followSets) {
         for (char terminal : entry.second) {
-            terminals.insert(terminal);
+            table.terminals.set((unsigned char)terminal);
         }
     }
     
-    // Create and display the table header
-    cout << setw(10) << " ";
-    for (char terminal : terminals) {
-        cout << setw(10) << terminal;
-    }
-    cout << endl;
-    
     // For each non-terminal
     for (const auto& entry : grammar.productions) {
         char nonTerminal = entry.first;
-        cout << setw(10) << nonTerminal;
+        int row = table.nonTerminals.size();
+        table.rowOf[(unsigned char)nonTerminal] = row;
+        table.nonTerminals.push_back(nonTerminal);
+        table.rows.emplace_back();
+        table.rows.back().fill(-1);
         
-        // For each terminal
-        for (char terminal : terminals) {
-            string tableEntry = "";
+        for (const vector<char>& production : entry.second) {
+            int p = table.productions.size();
+            table.productionLhs.push_back(nonTerminal);
+            table.productions.push_back(production);
             
-            // Check each production
-            for (size_t i = 0; i < entry.second.size(); i++) {
-                const vector<char>& production = entry.second[i];
-                
-                // Calculate FIRST set of the production
-                set<char> productionFirst;
-                bool canDeriveEpsilon = true;
+            // Calculate FIRST set of the production
+            bitset<256> productionFirst;
+            bool canDeriveEpsilon = true;
+            
+            for (char symbol : production) {
+                if (symbol == 'e') {
+                    break;
+                }
                 
-                for (char symbol : production) {
-                    if (symbol == 'e') {
-                        productionFirst.insert('e');
-                        break;
-                    }
-                    
-                    if (!(symbol >= 'A' && symbol <= 'Z')) {
-                        productionFirst.insert(symbol);
-                        canDeriveEpsilon = false;
-                        break;
-                    }
-                    
-                    bool symbolCanDeriveEpsilon = false;
-                    for (char c : firstSets.at(symbol)) {
-                        if (c == 'e') {
-                            symbolCanDeriveEpsilon = true;
-                        } else {
-                            productionFirst.insert(c);
-                        }
-                    }
-                    
-                    if (!symbolCanDeriveEpsilon) {
-                        canDeriveEpsilon = false;
-                        break;
-                    }
+                if (!(symbol >= 'A' && symbol <= 'Z')) {
+                    productionFirst.set((unsigned char)symbol);
+                    canDeriveEpsilon = false;
+                    break;
                 }
                 
-                // If the production can derive epsilon, add FOLLOW(A) to the FIRST set
-                if (canDeriveEpsilon || (production.size() == 1 && production[0] == 'e')) {
-                    productionFirst.insert('e');
-                    for (char c : followSets.at(nonTerminal)) {
-                        productionFirst.insert(c);
+                bool symbolCanDeriveEpsilon = false;
+                for (char c : firstSets.at(symbol)) {
+                    if (c == 'e') {
+                        symbolCanDeriveEpsilon = true;
+                    } else {
+                        productionFirst.set((unsigned char)c);
                     }
                 }
                 
-                // If the terminal is in the FIRST set of the production, add the production to the table
-                if (productionFirst.find(terminal) != productionFirst.end()) {
-                    if (!tableEntry.empty()) {
-                        tableEntry += "/";  // Conflict
-                    }
-                    
-                    tableEntry += nonTerminal;
-                    tableEntry += "->";
-                    for (char symbol : production) {
-                        tableEntry += symbol;
-                    }
+                if (!symbolCanDeriveEpsilon) {
+                    canDeriveEpsilon = false;
+                    break;
+                }
+            }
+            
+            // If the production can derive epsilon, add FOLLOW(A) to the FIRST set
+            if (canDeriveEpsilon) {
+                for (char c : followSets.at(nonTerminal)) {
+                    productionFirst.set((unsigned char)c);
                 }
             }
             
+            // Put the production in the cell of every terminal in its FIRST set
+            for (int terminal = 0; terminal < 256; terminal++) {
+                if (!productionFirst[terminal] || !table.terminals[terminal]) continue;
+                int& cell = table.rows[row][terminal];
+                if (cell >= 0) {  // Conflict, keep all productions of the cell
+                    vector<int>& all = table.conflicts[{row, terminal}];
+                    if (all.empty()) all.push_back(cell);
+                    all.push_back(p);
+                } else {
+                    cell = p;
+                }
+            }
+        }
+    }
+    
+    return table;
+}
+
+// Function to print LL(1) parsing table. Conflicting productions are joined with '/'
+void printLL1Table(const LL1Table& table) {
+    cout << "\nLL(1) Parsing Table:" << endl;
+    
+    // Create and display the table header
+    cout << setw(10) << " ";
+    for (int terminal = 0; terminal < 256; terminal++) {
+        if (table.terminals[terminal]) cout << setw(10) << (char)terminal;
+    }
+    cout << endl;
+    
+    for (size_t row = 0; row < table.rows.size(); row++) {
+        cout << setw(10) << table.nonTerminals[row];
+        for (int terminal = 0; terminal < 256; terminal++) {
+            if (!table.terminals[terminal]) continue;
+            string tableEntry = "";
+            for (int p : table.cell(row, terminal)) {
+                if (!tableEntry.empty()) {
+                    tableEntry += "/";  // Conflict
+                }
+                tableEntry += table.productionString(p);
+            }
             cout << setw(10) << tableEntry;
         }
-        
         cout << endl;
     }
 }
 
-int main() {
+// Quote a CSV field if it contains a comma, a quote or a line break
+string csvField(const string& text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) return text;
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Write the table as CSV: a header row with the terminals, then one row per non-terminal
+void writeTableCSV(const LL1Table& table, ostream& out) {
+    out << "nonterminal";
+    for (int terminal = 0; terminal < 256; terminal++) {
+        if (table.terminals[terminal]) out << "," << csvField(string(1, (char)terminal));
+    }
+    out << "\n";
+    for (size_t row = 0; row < table.rows.size(); row++) {
+        out << csvField(string(1, table.nonTerminals[row]));
+        for (int terminal = 0; terminal < 256; terminal++) {
+            if (!table.terminals[terminal]) continue;
+            string tableEntry;
+            for (int p : table.cell(row, terminal)) {
+                if (!tableEntry.empty()) tableEntry += "/";
+                tableEntry += table.productionString(p);
+            }
+            out << "," << csvField(tableEntry);
+        }
+        out << "\n";
+    }
+}
+
+// Return a string as a JSON string literal, with special characters escaped
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Write the table as JSON: the productions by number, and for each row the filled cells
+// as lists of production numbers (more than one when there is a conflict)
+void writeTableJSON(const LL1Table& table, ostream& out) {
+    out << "{\"start\":" << jsonString(string(1, table.startSymbol)) << ",\"terminals\":[";
+    bool first = true;
+    for (int terminal = 0; terminal < 256; terminal++) {
+        if (!table.terminals[terminal]) continue;
+        out << (first ? "" : ",") << jsonString(string(1, (char)terminal));
+        first = false;
+    }
+    out << "],\"productions\":[";
+    for (size_t p = 0; p < table.productions.size(); p++) {
+        out << (p ? "," : "") << "{\"lhs\":" << jsonString(string(1, table.productionLhs[p]))
+            << ",\"rhs\":" << jsonString(string(table.productions[p].begin(), table.productions[p].end())) << "}";
+    }
+    out << "],\"table\":{";
+    for (size_t row = 0; row < table.rows.size(); row++) {
+        out << (row ? "," : "") << jsonString(string(1, table.nonTerminals[row])) << ":{";
+        first = true;
+        for (int terminal = 0; terminal < 256; terminal++) {
+            vector<int> cell = table.terminals[terminal] ? table.cell(row, terminal) : vector<int>();
+            if (cell.empty()) continue;
+            out << (first ? "" : ",") << jsonString(string(1, (char)terminal)) << ":[";
+            for (size_t k = 0; k < cell.size(); k++) out << (k ? "," : "") << cell[k];
+            out << "]";
+            first = false;
+        }
+        out << "}";
+    }
+    out << "},\"conflicts\":" << table.conflicts.size() << "}\n";
+}
+
+// Write the table to a file with the given writer; report an error if the file cannot be created
+void exportTable(const LL1Table& table, const string& filename,
+                 void (*writer)(const LL1Table&, ostream&)) {
+    ofstream fout(filename);
+    if (!fout) {
+        cerr << "Error opening file: " << filename << endl;
+        exit(1);
+    }
+    writer(table, fout);
+    cout << "\nTable written to " << filename << endl;
+}
+
+// Character-level LL(1) parser without a scanner: each input byte is one terminal and
+// each line is one sentence. Rows are 256 cells indexed by the byte, and right sides
+// are stored reversed in one pool so that an expansion is a single copy onto the stack.
+// Input can arrive in blocks of any size, and a line may be split between blocks.
+// The table must have no conflicts, otherwise an expansion may never end
+class CharParser {
+public:
+    explicit CharParser(const LL1Table& table) : startSymbol(table.startSymbol) {
+        copy(begin(table.rowOf), end(table.rowOf), rowOf);
+        cells.reserve(table.rows.size() * 256);
+        for (const auto& row : table.rows) {
+            cells.insert(cells.end(), row.begin(), row.end());
+        }
+        rhsStart.push_back(0);
+        size_t longest = 0;
+        for (const vector<char>& production : table.productions) {
+            for (auto it = production.rbegin(); it != production.rend(); ++it) {
+                if (*it != 'e') rhsPool.push_back(*it);
+            }
+            longest = max(longest, rhsPool.size() - rhsStart.back());
+            rhsStart.push_back(rhsPool.size());
+        }
+        stack.resize(STACK_LIMIT + longest);
+        resetLine();
+    }
+    
+    // Parse the next block of input; the state is kept for the next call
+    void feed(const char* data, size_t size) {
+        const char* end = data + size;
+        while (data < end) {
+            if (failed) {  // Skip the rest of a rejected line
+                const char* newline = (const char*)memchr(data, '\n', end - data);
+                if (!newline) {
+                    column += end - data;
+                    return;
+                }
+                data = newline;
+            }
+            unsigned char c = *data++;
+            if (c == '\n') {
+                endLine();
+                continue;
+            }
+            column++;
+            if (c != '\r' && !shift(c)) fail(c);
+        }
+    }
+    
+    // End of input; the last line may have no newline
+    void finish() {
+        if (column > 0) endLine();
+    }
+    
+    long long acceptedLines() const { return accepted; }
+    long long rejectedLines() const { return rejected; }
+    
+private:
+    static const size_t STACK_LIMIT = 1 << 20;  // Reject lines that nest deeper than this
+    
+    char startSymbol;
+    int rowOf[256];
+    vector<int> cells;             // Row * 256 + byte -> production number, -1 if empty
+    vector<char> rhsPool;          // Right sides reversed, without 'e'
+    vector<size_t> rhsStart;       // Production p is rhsPool[rhsStart[p] .. rhsStart[p + 1])
+    vector<char> stack;            // Fixed size, only stack[0 .. depth) is in use
+    size_t depth = 0;
+    long long line = 1, column = 0;
+    bool failed = false;
+    long long accepted = 0, rejected = 0;
+    
+    void resetLine() {
+        stack[0] = '$';
+        stack[1] = startSymbol;
+        depth = 2;
+        column = 0;
+        failed = false;
+    }
+    
+    // Expand until a terminal is on top, then match c. The '$' at the bottom is never
+    // matched by a byte, it is only used at the end of a line
+    bool shift(unsigned char c) {
+        while (true) {
+            unsigned char top = stack[depth - 1];
+            int row = rowOf[top];
+            if (row < 0) {
+                if (top != c || depth == 1) return false;
+                depth--;
+                return true;
+            }
+            if (!expand(cells[row * 256 + c])) return false;
+        }
+    }
+    
+    bool expand(int p) {
+        if (p < 0 || depth > STACK_LIMIT) return false;
+        size_t length = rhsStart[p + 1] - rhsStart[p];
+        memcpy(&stack[depth - 1], &rhsPool[rhsStart[p]], length);
+        depth += length - 1;
+        return true;
+    }
+    
+    void fail(unsigned char c) {
+        failed = true;
+        rejected++;
+        cout << "Line " << line << ", column " << column << ": unexpected ";
+        if (c >= 0x20 && c < 0x7f) {
+            cout << "'" << c << "'";
+        } else {
+            cout << "byte " << (int)c;
+        }
+        cout << "\n";
+    }
+    
+    // The line has ended: expand on '$' until only the bottom of the stack is left
+    void endLine() {
+        if (!failed) {
+            int row;
+            while ((row = rowOf[(unsigned char)stack[depth - 1]]) >= 0 && expand(cells[row * 256 + '$'])) {
+            }
+            if (depth == 1) {
+                accepted++;
+            } else {
+                rejected++;
+                cout << "Line " << line << ", column " << column + 1 << ": unexpected end of line\n";
+            }
+        }
+        line++;
+        resetLine();
+    }
+};
+
+// Parse an input file with CharParser, one sentence per line. The file is mapped into
+// memory and passed to the parser in blocks; if it cannot be mapped (e.g. a pipe), it is
+// read in blocks instead
+void parseInputFile(const LL1Table& table, const string& filename, size_t blockSize) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file: " << filename << endl;
+        exit(1);
+    }
+    
+    cout << "\nParsing " << filename << ":" << endl;
+    CharParser parser(table);
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (mapped != MAP_FAILED) {
+        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+        const char* data = (const char*)mapped;
+        for (size_t offset = 0; offset < (size_t)info.st_size; offset += blockSize) {
+            parser.feed(data + offset, min(blockSize, (size_t)info.st_size - offset));
+        }
+        munmap(mapped, info.st_size);
+    } else {
+        vector<char> buffer(blockSize);
+        ssize_t got;
+        while ((got = read(fd, buffer.data(), buffer.size())) > 0) {
+            parser.feed(buffer.data(), got);
+        }
+    }
+    close(fd);
+    parser.finish();
+    
+    cout << "Lines: " << parser.acceptedLines() + parser.rejectedLines()
+         << ", accepted: " << parser.acceptedLines()
+         << ", rejected: " << parser.rejectedLines() << endl;
+}
+
+// Read a positive byte count for --block-size; false if the text is not one
+bool parseBlockSize(const char* text, size_t& blockSize) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (!isdigit((unsigned char)text[0]) || *end != '\0' || errno == ERANGE || value == 0 || value > SIZE_MAX / 2) {
+        return false;
+    }
+    blockSize = value;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
     // read grammar from file
     string filename = "example1.txt";
+    string csvFile, jsonFile;  // Export the table to these files if given
+    string inputFile;  // Parse this file with the table if given
+    size_t blockSize = 1 << 20;  // Bytes passed to the parser at a time
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--grammar" && i + 1 < argc) {
+            filename = argv[++i];
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csvFile = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (arg == "--parse" && i + 1 < argc) {
+            inputFile = argv[++i];
+        } else if (arg == "--block-size" && i + 1 < argc && parseBlockSize(argv[i + 1], blockSize)) {
+            i++;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--grammar FILE] [--csv FILE] [--json FILE]"
+                 << " [--parse FILE] [--block-size BYTES]" << endl;
+            return 1;
+        }
+    }
     
-    Grammar originalGrammar = readGrammar(filename);
+    // One grammar object, every pass change it in place
+    Grammar grammar = readGrammar(filename);
     
     // do left factoring
-    Grammar factoredGrammar = applyLeftFactoring(originalGrammar);
-    printGrammar(factoredGrammar, "Grammar After Left Factoring");
+    applyLeftFactoring(grammar);
+    printGrammar(grammar, "Grammar After Left Factoring");
     
     // remove left recursion
-    Grammar finalGrammar = removeLeftRecursion(factoredGrammar);
-    printGrammar(finalGrammar, "Grammar After Left Recursion Removal");
+    removeLeftRecursion(grammar);
+    printGrammar(grammar, "Grammar After Left Recursion Removal");
     
     // first() sets
-    map<char, set<char>> firstSets = computeFirstSets(finalGrammar);
+    map<char, set<char>> firstSets = computeFirstSets(grammar);
     printSets(firstSets, "FIRST Sets");
     
     // follor() sets
-    map<char, set<char>> followSets = computeFollowSets(finalGrammar, firstSets);
+    map<char, set<char>> followSets = computeFollowSets(grammar, firstSets);
     printSets(followSets, "FOLLOW Sets");
     
     // LL(1) parsing table
-    constructLL1Table(finalGrammar, firstSets, followSets);
+    LL1Table table = constructLL1Table(grammar, firstSets, followSets);
+    printLL1Table(table);
+    if (!csvFile.empty()) exportTable(table, csvFile, writeTableCSV);
+    if (!jsonFile.empty()) exportTable(table, jsonFile, writeTableJSON);
+    
+    // Parse the input with the table, using bytes as terminals. A table with conflicts can
+    // expand forever without reading input (e.g. C->C|e), so it is refused
+    if (!inputFile.empty()) {
+        if (!table.conflicts.empty()) {
+            cerr << "Error: cannot parse " << inputFile << ", the grammar is not LL(1) ("
+                 << table.conflicts.size() << " conflicting cells)" << endl;
+            return 1;
+        }
+        parseInputFile(table, inputFile, blockSize);
+    }
     
     cout << "\nDone!" << endl;
     return 0;
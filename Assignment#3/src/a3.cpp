@@ -8,6 +8,29 @@
 #include <iomanip>
 #include <sstream>
 #include <stack>
+#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <charconv>
+#include <limits>
+#include <optional>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -17,65 +40,371 @@ struct Grammar {
     string startSymbol; // This is where grammar start
 };
 
-// Define LL(1) parse table
-typedef map<string, map<string, vector<string>>> ParseTable; // First map non-terminal, second map terminal, then production
+// Hash for string keys, it let us search map with string_view without making string
+struct SymbolHash {
+    using is_transparent = void;
+    size_t operator()(string_view s) const { return hash<string_view>{}(s); }
+};
+
+// Symbol table. Every grammar symbol get small int id so parser compare int not string.
+// Terminals get id 0..T-1 and non-terminals get T..T+N-1, both in sorted order
+struct SymbolTable {
+    vector<string> names; // id -> name
+    unordered_map<string, int, SymbolHash, equal_to<>> ids; // name -> id
+    int terminalCount = 0;
+
+    int add(const string& name) { // Give id to symbol, same id if already have
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        int id = (int)names.size();
+        names.push_back(name);
+        ids[name] = id;
+        return id;
+    }
+
+    int find(string_view name) const { // Id of symbol, -1 if not known
+        auto it = ids.find(name);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    bool isNonTerminal(int id) const { return id >= terminalCount; }
+    int nonTerminalCount() const { return (int)names.size() - terminalCount; }
+    const string& name(int id) const { return names[id]; }
+};
+
+const int NO_PRODUCTION = -1; // Empty cell in parse table
+
+// One place of compressed table: which row own it and its production
+struct PackedCell {
+    int32_t row;
+    int32_t production;
+};
+
+// Define LL(1) parse table. Every production stored one time in a pool and
+// table is flat (non-terminals x terminals) array of production ids
+struct ParseTable {
+    SymbolTable symbols;
+    int startSymbol = -1; // Id of start symbol
+    int endMarker = -1; // Id of $
+    vector<int> productionLhs; // Production id -> non-terminal id
+    vector<int> productionStart; // Production id -> where its symbols start in pool, one extra at end
+    vector<int> pool; // Right side of all productions one after other, epsilon is empty
+    vector<int> cells; // Row for each non-terminal, column for each terminal
+    int conflicts = 0; // Cells where two different productions met, only set by constructLL1Table (not cached)
+
+    // Compressed layout, used instead of cells when rowBase not empty. Cell of row r
+    // and terminal t is packed[rowBase[r] + t] if that place belong to row r
+    vector<int> rowBase;
+    vector<PackedCell> packed;
+
+    bool compressed() const { return !rowBase.empty(); }
+
+    int lookup(int nonTerminal, int terminal) const { // Production id or NO_PRODUCTION
+        int row = nonTerminal - symbols.terminalCount;
+        if (compressed()) {
+            const PackedCell& cell = packed[(size_t)rowBase[row] + terminal];
+            return cell.row == row ? cell.production : NO_PRODUCTION;
+        }
+        return cells[(size_t)row * symbols.terminalCount + terminal];
+    }
+    int productionCount() const { return (int)productionLhs.size(); }
+    const int* productionBegin(int p) const { return pool.data() + productionStart[p]; }
+    const int* productionEnd(int p) const { return pool.data() + productionStart[p + 1]; }
+};
+
+// Set of terminals, one bit for each terminal id. Union is OR over 64-bit words,
+// which compiler can vectorize, and it also tell if anything new was added
+class TerminalSet {
+private:
+    vector<uint64_t> words;
+
+public:
+    explicit TerminalSet(int terminalCount = 0) : words((terminalCount + 63) / 64, 0) {}
+
+    bool insert(int id) { // Add terminal, true if it was not there
+        uint64_t bit = 1ULL << (id & 63);
+        bool added = (words[id >> 6] & bit) == 0;
+        words[id >> 6] |= bit;
+        return added;
+    }
+
+    bool contains(int id) const { return (words[id >> 6] >> (id & 63)) & 1; }
+
+    bool unionWith(const TerminalSet& other) { // Add all of other, true if something new
+        uint64_t changed = 0;
+        for (size_t i = 0; i < words.size(); i++) {
+            uint64_t merged = words[i] | other.words[i];
+            changed |= merged ^ words[i];
+            words[i] = merged;
+        }
+        return changed != 0;
+    }
+
+    void clear() { fill(words.begin(), words.end(), 0); }
+
+    template <typename Function>
+    void forEach(Function function) const { // Call function for every terminal id, in order
+        for (size_t i = 0; i < words.size(); i++) {
+            for (uint64_t w = words[i]; w != 0; w &= w - 1) {
+                function((int)(i * 64 + __builtin_ctzll(w)));
+            }
+        }
+    }
+
+    vector<uint64_t>& data() { return words; }
+    const vector<uint64_t>& data() const { return words; }
+};
+
+// FIRST and FOLLOW sets for every non-terminal, index is id - terminalCount
+struct GrammarSets {
+    vector<TerminalSet> first;
+    vector<bool> nullable; // Non-terminal can derive epsilon, "e" of FIRST set
+    vector<TerminalSet> follow;
+};
+
+// Productions of grammar written with symbol ids, one after other. "e" is left out
+struct IdGrammar {
+    vector<int> lhs; // Production -> non-terminal id
+    vector<int> start; // Production -> where its symbols start, one extra at end
+    vector<int> symbols;
+
+    int productionCount() const { return (int)lhs.size(); }
+};
+
+// How much of parsing is written: nothing, only result of each line, every step as
+// text table, or every step as compact binary records
+enum class TraceMode { None, Summary, Full, Binary };
+
+// Step kinds of binary trace. Each step is kind byte then int32 value: token offset in
+// line for match, shift and skip, production for expand and reduce, symbol for pop,
+// error count for line end
+enum TraceStep : uint8_t {
+    STEP_LINE_END, STEP_MATCH, STEP_EXPAND, STEP_SKIP, STEP_POP, STEP_END_OF_INPUT, STEP_ACCEPT,
+    STEP_SHIFT, STEP_REDUCE
+};
+
+const char TRACE_RULE[] = "--------------------------------------------------"; // 50 dashes
+
+// Output layer for traces and tables. Everything go into one big buffer made at start,
+// columns are padded by hand (no setw), and buffer is written to sink only when full or
+// at flush, never per line. Without sink the text stay in buffer, for worker threads
+class TraceOutput {
+private:
+    string buffer;
+    ostream* sink;
+    size_t capacity;
+
+public:
+    TraceMode mode;
+
+    explicit TraceOutput(ostream* sink, TraceMode mode = TraceMode::Full, size_t capacity = 1 << 20)
+        : sink(sink), capacity(capacity), mode(mode) {
+        buffer.reserve(capacity);
+    }
+    ~TraceOutput() { flush(); }
+
+    bool full() const { return mode == TraceMode::Full; } // Every step as text
+    bool text() const { return mode == TraceMode::Full || mode == TraceMode::Summary; }
+    bool binary() const { return mode == TraceMode::Binary; }
+
+    void put(string_view text) {
+        if (sink && buffer.size() + text.size() > capacity) spill();
+        buffer.append(text);
+    }
+    void put(char c) {
+        if (sink && buffer.size() + 1 > capacity) spill();
+        buffer.push_back(c);
+    }
+    void pad(size_t count) { // Spaces
+        if (sink && buffer.size() + count > capacity) spill();
+        buffer.append(count, ' ');
+    }
+    void putRight(string_view text, int width) { // Right aligned like setw, long text not cut
+        if ((int)text.size() < width) pad(width - text.size());
+        put(text);
+    }
+    void putNumber(long long value) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        put(string_view(digits, result.ptr - digits));
+    }
+    void putRightNumber(long long value, int width) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        putRight(string_view(digits, result.ptr - digits), width);
+    }
+    template <typename T>
+    void putBinary(T value) { put(string_view((const char*)&value, sizeof(T))); }
+    void step(TraceStep kind, int32_t value) { // One binary step
+        putBinary<uint8_t>(kind);
+        putBinary<int32_t>(value);
+    }
+
+    void spill() { // Give buffer to sink, no flush
+        if (!sink) return;
+        sink->write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    void flush() {
+        spill();
+        if (sink) sink->flush();
+    }
+    string take() { // Text collected without sink
+        string result;
+        result.swap(buffer);
+        return result;
+    }
+};
+
+// One input token. Text is view inside the input line, so no copy made
+struct Token {
+    int id; // Symbol id, -1 if grammar not know it
+    string_view text;
+};
+
+// Split line into tokens one at a time, whitespace separate them. After last
+// token it give the $ end marker, after that it is finished
+class TokenCursor {
+private:
+    const SymbolTable& symbols;
+    string_view line;
+    size_t pos = 0; // Where next token search start
+    int endMarker;
+    Token current{-1, {}};
+    bool atMarker = false; // Current token is the $ we add at end
+    bool finished = false;
+
+public:
+    TokenCursor(const SymbolTable& symbols, string_view line, int endMarker)
+        : symbols(symbols), line(line), endMarker(endMarker) {
+        advance();
+    }
+
+    const Token& peek() const { return current; } // Token we look at now
+    bool atEnd() const { return finished; } // True when even $ is used
+    bool atEndMarker() const { return atMarker; } // True when all real tokens are used
+
+    void advance() { // Go to next token
+        if (atMarker) {
+            finished = true;
+            return;
+        }
+        while (pos < line.size() && isspace((unsigned char)line[pos])) pos++;
+        if (pos >= line.size()) {
+            current = {endMarker, "$"};
+            atMarker = true;
+            return;
+        }
+        size_t start = pos;
+        while (pos < line.size() && !isspace((unsigned char)line[pos])) pos++;
+        current.text = line.substr(start, pos - start);
+        current.id = symbols.find(current.text);
+    }
+
+    // Write rest of input (from current token) like "a b $ ", right aligned in width
+    void writeRest(TraceOutput& out, int width) const {
+        string_view rest;
+        if (!atMarker) {
+            rest = line.substr(current.text.data() - line.data());
+            while (!rest.empty() && isspace((unsigned char)rest.back())) rest.remove_suffix(1);
+        }
+        size_t length = finished ? 0 : rest.size() + (rest.empty() ? 2 : 3);
+        if ((int)length < width) out.pad(width - length);
+        if (finished) return;
+        out.put(rest);
+        out.put(rest.empty() ? "$ " : " $ ");
+    }
 
-// Class to handle parsing stack
+    size_t offset() const { return current.text.data() - line.data(); } // Where current token start
+};
+
+// Class to handle parsing stack. Symbols kept as ids in one vector. When trace is
+// wanted, stack also keep its text like "$ E T" and where each symbol text start,
+// so push and pop only touch end of text and showing the stack is free
 class ParsingStack {
 private:
-    stack<string> st; // Stack hold the symbols
+    vector<int> st; // Stack hold the symbol ids
+    vector<int> treeNodes; // Parse tree node of each symbol, -1 if no tree
+    const SymbolTable* traceSymbols; // Names for the trace text, null if no trace
+    string text; // Symbols joined with space
+    vector<size_t> textStart; // Where each symbol start in text
 
 public:
-    void push(const string& symbol) { // Push symbol to stack
-        st.push(symbol);
+    explicit ParsingStack(const SymbolTable* traceSymbols = nullptr, size_t capacity = 64)
+        : traceSymbols(traceSymbols) {
+        st.reserve(capacity); // Reserve ahead, most line no need more
+        treeNodes.reserve(capacity);
+        if (traceSymbols) {
+            textStart.reserve(capacity);
+            text.reserve(capacity * 4);
+        }
+    }
+
+    void push(int symbol, int treeNode = -1) { // Push symbol to stack
+        st.push_back(symbol);
+        treeNodes.push_back(treeNode);
+        if (traceSymbols) {
+            textStart.push_back(text.size());
+            if (!text.empty()) text += ' ';
+            text += traceSymbols->name(symbol);
+        }
     }
 
-    string pop() { // Pop top element from stack
+    int pop() { // Pop top element from stack
         if (st.empty()) { // If nothing inside, show error
             cerr << "Error: Stack underflow!" << endl;
-            return "";
+            return -1;
+        }
+        int top = st.back();
+        st.pop_back();
+        treeNodes.pop_back();
+        if (traceSymbols) {
+            text.resize(textStart.back());
+            textStart.pop_back();
         }
-        string top = st.top(); // Get top element
-        st.pop(); // Remove top element
         return top;
     }
 
-    string top() { // Just see top element, no remove
+    int top() const { // Just see top element, no remove
         if (st.empty()) { // If stack empty, show error
             cerr << "Error: Empty stack!" << endl;
-            return "";
+            return -1;
         }
-        return st.top(); // Give top element
+        return st.back();
     }
 
-    bool empty() { // Check if stack no have anything
+    int topNode() const { return treeNodes.empty() ? -1 : treeNodes.back(); } // Tree node of top
+
+    bool empty() const { // Check if stack no have anything
         return st.empty();
     }
 
-    string toString() { // Make stack elements into nice string
-        string result = "[";
-        stack<string> temp = st; // Copy of stack, so original not change
-        vector<string> contents;
-
-        while (!temp.empty()) { // Take all element one by one
-            contents.push_back(temp.top());
-            temp.pop();
-        }
+    size_t size() const { return st.size(); }
 
-        reverse(contents.begin(), contents.end()); // Put back in correct order
+    // Write stack like [$ E T] right aligned in width, need trace on
+    void write(TraceOutput& out, int width) const {
+        if ((int)text.size() + 2 < width) out.pad(width - text.size() - 2);
+        out.put('[');
+        out.put(text);
+        out.put(']');
+    }
 
-        for (size_t i = 0; i < contents.size(); i++) { // Join with space
-            result += contents[i];
-            if (i < contents.size() - 1) {
-                result += " ";
-            }
+    string toString(const SymbolTable& symbols) const { // Make stack elements into nice string
+        string result = "[";
+        for (size_t i = 0; i < st.size(); i++) { // Join with space
+            if (i > 0) result += " ";
+            result += symbols.name(st[i]);
         }
-
         result += "]";
         return result;
     }
 };
 
+// Check if symbol is non-terminal (start with capital letter)
+bool isNonTerminalName(const string& symbol) {
+    return symbol[0] >= 'A' && symbol[0] <= 'Z';
+}
+
 // Function for reading grammar from file
 Grammar readGrammar(const string& filename) {
     Grammar grammar;
@@ -93,16 +422,21 @@ Grammar readGrammar(const string& filename) {
     while (getline(fin, line)) { // Read line by line
         cout << line << endl;
 
+        // Non-terminal is everything before "->", so names like Expr or N12 also work
+        size_t arrow = line.find("->");
+        if (arrow == string::npos) continue; // Skip empty or broken line
+        string nonTerminal;
+        istringstream(line.substr(0, arrow)) >> nonTerminal;
+
         if (isFirst) { // First line, so set start symbol
-            grammar.startSymbol = string(1, line[0]);
+            grammar.startSymbol = nonTerminal;
             isFirst = false;
         }
 
-        string nonTerminal = string(1, line[0]); // First character is non-terminal
         vector<vector<string>> productions;
         vector<string> currentProduction;
 
-        string rhs = line.substr(3); // Skip A-> part
+        string rhs = line.substr(arrow + 2); // Skip A-> part
         istringstream iss(rhs);
         string token;
         while (iss >> token) { // Split using spaces
@@ -125,6 +459,7 @@ Grammar readGrammar(const string& filename) {
 
 // Function to print grammar nicely
 void printGrammar(const Grammar& grammar, const string& title) {
+    if (!cout) return; // Output is turned off, do not format big grammar for nothing
     cout << "\n" << title << ":" << endl;
     for (const auto& entry : grammar.productions) { // For each non-terminal
         cout << entry.first << "->";
@@ -141,365 +476,656 @@ void printGrammar(const Grammar& grammar, const string& title) {
     }
 }
 
-// Function to do left factoring
-Grammar applyLeftFactoring(const Grammar& original) {
-    Grammar result = original;
-    bool factored = false; // Track if factoring done
-    map<string, vector<vector<string>>> newProductions;
-
-    for (const auto& entry : result.productions) {
-        string nonTerminal = entry.first;
-        vector<vector<string>> productions = entry.second;
-
-        // Try find common prefix
-        for (size_t i = 0; i < productions.size(); i++) {
-            for (size_t j = i + 1; j < productions.size(); j++) {
-                // Find how many same in start
-                size_t k = 0;
-                while (k < productions[i].size() && k < productions[j].size() &&
-                       productions[i][k] == productions[j][k]) {
-                    k++;
-                }
-
-                if (k > 0) {  // If common prefix found
-                    factored = true;
-
-                    // Make new non-terminal
-                    string newNonTerminal = "Z";
-                    while (result.productions.find(newNonTerminal) != result.productions.end() ||
-                           newProductions.find(newNonTerminal) != newProductions.end()) {
-                        newNonTerminal[0]--; // Try Z, then Y, X, etc
-                    }
-
-                    // Make production for new non-terminal
-                    vector<vector<string>> newNonTerminalProductions;
+// Make fresh non-terminal names for left factoring: Z, Y, ... A, then Z1, Y1, ... A1,
+// Z2 and so on, skipping names the grammar already use. It never run out
+class FreshNames {
+private:
+    set<string> used;
+    int next = 0;
 
-                    // Take remaining part after prefix
-                    vector<string> suffix1(productions[i].begin() + k, productions[i].end());
-                    vector<string> suffix2(productions[j].begin() + k, productions[j].end());
+public:
+    explicit FreshNames(const Grammar& grammar) {
+        for (const auto& entry : grammar.productions) {
+            used.insert(entry.first);
+            for (const auto& production : entry.second) {
+                used.insert(production.begin(), production.end());
+            }
+        }
+    }
 
-                    if (suffix1.empty()) suffix1.push_back("e"); // If nothing left, use epsilon
-                    if (suffix2.empty()) suffix2.push_back("e");
+    string make() {
+        while (true) {
+            string name(1, (char)('Z' - next % 26));
+            if (next >= 26) name += to_string(next / 26);
+            next++;
+            if (used.insert(name).second) return name;
+        }
+    }
+};
 
-                    newNonTerminalProductions.push_back(suffix1);
-                    newNonTerminalProductions.push_back(suffix2);
+// Prefix trie of the alternatives of one non-terminal. Children kept in order
+// they first seen, so output keep the order of the grammar. Symbol "" mark that
+// an alternative end at this node
+struct PrefixTrie {
+    vector<vector<pair<string, int>>> children = {{}}; // Node 0 is root
+
+    void insert(const vector<string>& production) {
+        int node = 0;
+        bool epsilon = production.size() == 1 && production[0] == "e";
+        for (size_t i = 0; i <= production.size(); i++) {
+            const string& symbol = (i == production.size() || epsilon) ? string() : production[i];
+            int child = -1;
+            for (const auto& edge : children[node]) {
+                if (edge.first == symbol) child = edge.second;
+            }
+            if (child == -1) {
+                child = (int)children.size();
+                children[node].push_back({symbol, child});
+                children.emplace_back();
+            }
+            if (symbol.empty()) return;
+            node = child;
+        }
+    }
+};
 
-                    // Update original non-terminal
-                    vector<string> prefix(productions[i].begin(), productions[i].begin() + k);
-                    prefix.push_back(newNonTerminal);
+// Make alternatives for the part of trie under node. Path with no branch is kept
+// as it is, where path branch a new non-terminal take all the different suffixes
+void factorTrieNode(const PrefixTrie& trie, int node, vector<vector<string>>& alternatives,
+                    map<string, vector<vector<string>>>& newProductions, FreshNames& names) {
+    for (const auto& edge : trie.children[node]) {
+        vector<string> alternative;
+        if (edge.first.empty()) { // An alternative end here
+            alternatives.push_back({"e"});
+            continue;
+        }
 
-                    // Remove old productions
-                    if (j > i) {
-                        productions.erase(productions.begin() + j);
-                        productions.erase(productions.begin() + i);
-                    } else {
-                        productions.erase(productions.begin() + i);
-                        productions.erase(productions.begin() + j);
-                    }
+        // Follow the path while it not branch and nothing end on it
+        int current = edge.second;
+        alternative.push_back(edge.first);
+        while (trie.children[current].size() == 1 && !trie.children[current][0].first.empty()) {
+            alternative.push_back(trie.children[current][0].first);
+            current = trie.children[current][0].second;
+        }
 
-                    productions.push_back(prefix); // Add new one with prefix
+        if (trie.children[current].size() > 1) { // Common prefix, factor it
+            string newNonTerminal = names.make();
+            alternative.push_back(newNonTerminal);
+            vector<vector<string>> suffixes;
+            factorTrieNode(trie, current, suffixes, newProductions, names);
+            newProductions[newNonTerminal] = suffixes;
+        }
+        alternatives.push_back(alternative);
+    }
+}
 
-                    newProductions[newNonTerminal] = newNonTerminalProductions; // Save new non-terminal
+// Function to do left factoring. Alternatives of every non-terminal go in a prefix
+// trie and all alternatives that share a prefix are factored together, again and
+// again down the trie, in one pass. Grammar is changed in place
+void applyLeftFactoring(Grammar& grammar) {
+    bool factored = false; // Track if factoring done
+    map<string, vector<vector<string>>> newProductions;
+    FreshNames names(grammar);
 
-                    i = -1; // Start again
-                    break;
-                }
-            }
+    for (auto& entry : grammar.productions) {
+        PrefixTrie trie;
+        for (const auto& production : entry.second) {
+            trie.insert(production);
         }
 
-        result.productions[nonTerminal] = productions; // Update
+        vector<vector<string>> productions;
+        size_t before = newProductions.size();
+        factorTrieNode(trie, 0, productions, newProductions, names);
+        if (newProductions.size() != before) {
+            factored = true;
+            entry.second = move(productions); // Update
+        }
     }
 
-    for (const auto& entry : newProductions) { // Add all new productions
-        result.productions[entry.first] = entry.second;
-    }
+    // Add all new productions, names are fresh so map nodes just move over
+    grammar.productions.merge(newProductions);
 
     if (factored) {
         cout << "\nLeft factoring was applied." << endl;
     } else {
         cout << "\nNo left factoring needed." << endl;
     }
+}
 
-    return result;
+// Give ids to all symbols of grammar. Terminals come first, then non-terminals
+SymbolTable buildSymbolTable(const Grammar& grammar) {
+    set<string> terminals = {"$"};
+    set<string> nonTerminals;
+
+    for (const auto& entry : grammar.productions) {
+        nonTerminals.insert(entry.first);
+        for (const auto& production : entry.second) {
+            for (const string& symbol : production) {
+                if (isNonTerminalName(symbol)) {
+                    nonTerminals.insert(symbol);
+                } else if (symbol != "e") {
+                    terminals.insert(symbol);
+                }
+            }
+        }
+    }
+
+    SymbolTable symbols;
+    for (const string& terminal : terminals) symbols.add(terminal);
+    symbols.terminalCount = (int)symbols.names.size();
+    for (const string& nonTerminal : nonTerminals) symbols.add(nonTerminal);
+    return symbols;
 }
 
-// DFS to find first set
-bool calculateFirstDFS(const string& symbol, const string& original, const string& last,
-                     const map<string, vector<vector<string>>>& productions,
-                     set<string>& firstSet) {
-    if (!(symbol[0] >= 'A' && symbol[0] <= 'Z')) { // If terminal or epsilon
-        firstSet.insert(symbol);
-        return symbol == "e";
+// Write grammar with ids, in same order as the grammar map
+IdGrammar toIdGrammar(const Grammar& grammar, const SymbolTable& symbols) {
+    IdGrammar result;
+    result.start.push_back(0);
+    for (const auto& entry : grammar.productions) {
+        int lhs = symbols.find(entry.first);
+        for (const auto& production : entry.second) {
+            result.lhs.push_back(lhs);
+            for (const string& symbol : production) {
+                if (symbol != "e") result.symbols.push_back(symbols.find(symbol));
+            }
+            result.start.push_back((int)result.symbols.size());
+        }
     }
+    return result;
+}
 
-    bool canDeriveEpsilon = false; // Track if epsilon possible
+// Strongly connected components of graph given as edge lists (Tarjan, no recursion
+// so deep grammar not overflow stack). Components come out in reverse topological
+// order: a component come before every component that has edge into it
+vector<vector<int>> stronglyConnectedComponents(const vector<vector<int>>& edges) {
+    const int count = (int)edges.size();
+    vector<int> order(count, -1), low(count, 0);
+    vector<bool> onStack(count, false);
+    vector<int> stack;
+    vector<pair<int, size_t>> path; // Node and next edge to look at
+    vector<vector<int>> components;
+    int counter = 0;
+
+    for (int root = 0; root < count; root++) {
+        if (order[root] != -1) continue;
+        path.push_back({root, 0});
+        while (!path.empty()) {
+            int node = path.back().first;
+            size_t& nextEdge = path.back().second;
+            if (nextEdge == 0 && order[node] == -1) {
+                order[node] = low[node] = counter++;
+                stack.push_back(node);
+                onStack[node] = true;
+            }
+            if (nextEdge < edges[node].size()) {
+                int next = edges[node][nextEdge++];
+                if (order[next] == -1) {
+                    path.push_back({next, 0});
+                } else if (onStack[next]) {
+                    low[node] = min(low[node], order[next]);
+                }
+                continue;
+            }
 
-    for (const auto& production : productions.at(symbol)) {
-        if (production.empty()) {
-            firstSet.insert("e"); // Empty means epsilon
-            canDeriveEpsilon = true;
-            continue;
+            // All edges done, close component if node is its root
+            if (low[node] == order[node]) {
+                components.emplace_back();
+                int member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack[member] = false;
+                    components.back().push_back(member);
+                } while (member != node);
+            }
+            path.pop_back();
+            if (!path.empty()) {
+                low[path.back().first] = min(low[path.back().first], low[node]);
+            }
         }
+    }
+    return components;
+}
+
+// Pool of worker threads for grammar analysis, with work stealing. Every worker have
+// own deque: it push and take at back, idle worker steal from front of others. Task get
+// id of worker running it, so new tasks it make go in that worker's deque. run() use
+// calling thread as worker 0 and return when all tasks are done
+class TaskPool {
+public:
+    using Task = function<void(int)>;
 
-        bool allCanDeriveEpsilon = true; // Assume all symbols can epsilon
+    explicit TaskPool(int workers) : queues(max(1, workers)) {}
 
-        for (size_t i = 0; i < production.size(); i++) {
-            string currentSymbol = production[i];
+    int workers() const { return (int)queues.size(); }
 
-            if (currentSymbol == symbol) { // Left recursion, skip
-                allCanDeriveEpsilon = false;
-                break;
+    void push(int worker, Task task) {
+        pending.fetch_add(1, memory_order_relaxed);
+        lock_guard<mutex> lock(queues[worker].lock);
+        queues[worker].tasks.push_back(move(task));
+    }
+
+    void run() {
+        vector<thread> threads;
+        for (int worker = 1; worker < workers(); worker++) {
+            threads.emplace_back([this, worker] { work(worker); });
+        }
+        work(0);
+        for (thread& t : threads) t.join();
+    }
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+    vector<Queue> queues;
+    atomic<long> pending{0}; // Tasks pushed and not finished, task push its children before it finish
+
+    bool take(int worker, Task& task) {
+        for (int i = 0; i < workers(); i++) {
+            Queue& queue = queues[(worker + i) % workers()];
+            lock_guard<mutex> lock(queue.lock);
+            if (queue.tasks.empty()) continue;
+            if (i == 0) { // Own deque, newest first
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else { // Steal oldest
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
             }
+            return true;
+        }
+        return false;
+    }
 
-            if (!(currentSymbol[0] >= 'A' && currentSymbol[0] <= 'Z')) { // If terminal
-                firstSet.insert(currentSymbol);
-                allCanDeriveEpsilon = (currentSymbol == "e");
-                break;
+    void work(int worker) {
+        Task task;
+        while (pending.load(memory_order_acquire) > 0) {
+            if (!take(worker, task)) {
+                this_thread::yield();
+                continue;
             }
+            task(worker);
+            task = nullptr;
+            pending.fetch_sub(1, memory_order_acq_rel);
+        }
+    }
+};
 
-            set<string> tempFirst;
-            bool symbolCanDeriveEpsilon = calculateFirstDFS(currentSymbol, original, production.back(),
-                                                         productions, tempFirst);
+// Close sets over edges in parallel: edge a -> b mean set of a go into set of b. All
+// members of strongly connected component end with same set, so every component is one
+// task which take union of its members and of components with edge into it. Component
+// is started when all those are done, so schedule follow topological order of components.
+// Result is same least fixpoint as the worklist gives
+void closeSetsByComponents(const vector<vector<int>>& edges, vector<TerminalSet>& sets, int jobs) {
+    vector<vector<int>> components = stronglyConnectedComponents(edges);
+    reverse(components.begin(), components.end()); // Now every edge go to later component
+
+    vector<int> componentOf(edges.size());
+    for (size_t c = 0; c < components.size(); c++) {
+        for (int member : components[c]) componentOf[member] = (int)c;
+    }
+    vector<vector<int>> from(components.size()), to(components.size());
+    for (size_t a = 0; a < edges.size(); a++) {
+        for (int b : edges[a]) {
+            if (componentOf[a] == componentOf[b]) continue;
+            to[componentOf[a]].push_back(componentOf[b]);
+            from[componentOf[b]].push_back(componentOf[a]);
+        }
+    }
+    vector<atomic<int>> waiting(components.size()); // Components before this one not done yet
+    for (size_t c = 0; c < components.size(); c++) {
+        for (auto* list : {&from[c], &to[c]}) {
+            sort(list->begin(), list->end());
+            list->erase(unique(list->begin(), list->end()), list->end());
+        }
+        waiting[c].store((int)from[c].size(), memory_order_relaxed);
+    }
 
-            for (const string& c : tempFirst) {
-                if (c != "e") {
-                    firstSet.insert(c); // Add terminals
-                }
+    TaskPool pool(jobs);
+    function<void(int, int)> solve = [&](int c, int worker) {
+        const vector<int>& members = components[c];
+        TerminalSet& total = sets[members[0]];
+        for (size_t i = 1; i < members.size(); i++) total.unionWith(sets[members[i]]);
+        for (int before : from[c]) total.unionWith(sets[components[before][0]]);
+        for (size_t i = 1; i < members.size(); i++) sets[members[i]] = total;
+
+        for (int next : to[c]) {
+            if (waiting[next].fetch_sub(1, memory_order_acq_rel) == 1) {
+                pool.push(worker, [&solve, next](int w) { solve(next, w); });
             }
+        }
+    };
+    for (size_t c = 0; c < components.size(); c++) {
+        if (from[c].empty()) pool.push(0, [&solve, c](int w) { solve((int)c, w); });
+    }
+    pool.run();
+}
 
-            if (!symbolCanDeriveEpsilon) {
-                allCanDeriveEpsilon = false;
+// Function to compute first sets for all non-terminals. It use worklist: first find
+// which non-terminals can give epsilon, then FIRST of B flow to A along edge B -> A
+// when B can start a production of A. Non-terminal only go back in worklist when its
+// set grow, so every production is looked a bounded number of times. With more jobs
+// the sets are closed over components of the graph on many threads instead
+GrammarSets computeFirstSets(const Grammar& grammar, const SymbolTable& symbols, int jobs = 1) {
+    const IdGrammar g = toIdGrammar(grammar, symbols);
+    const int terminalCount = symbols.terminalCount;
+    const int count = symbols.nonTerminalCount();
+
+    // Nullable: production is nullable when all its non-terminals are. Keep how many
+    // not known yet, and which productions use each non-terminal
+    GrammarSets sets;
+    sets.nullable.assign(count, false);
+    vector<int> remaining(g.productionCount(), 0);
+    vector<vector<int>> usedIn(count);
+    vector<int> worklist;
+    for (int p = 0; p < g.productionCount(); p++) {
+        int a = g.lhs[p] - terminalCount;
+        for (int k = g.start[p]; k < g.start[p + 1]; k++) {
+            if (!symbols.isNonTerminal(g.symbols[k])) {
+                remaining[p] = -1; // Have terminal, never nullable
                 break;
             }
-
-            if (i == production.size() - 1 && symbolCanDeriveEpsilon) {
-                canDeriveEpsilon = true;
+            remaining[p]++;
+            usedIn[g.symbols[k] - terminalCount].push_back(p);
+        }
+        if (remaining[p] == 0 && !sets.nullable[a]) {
+            sets.nullable[a] = true;
+            worklist.push_back(a);
+        }
+    }
+    while (!worklist.empty()) {
+        int b = worklist.back();
+        worklist.pop_back();
+        for (int p : usedIn[b]) {
+            int a = g.lhs[p] - terminalCount;
+            if (remaining[p] > 0 && --remaining[p] == 0 && !sets.nullable[a]) {
+                sets.nullable[a] = true;
+                worklist.push_back(a);
             }
         }
+    }
 
-        if (allCanDeriveEpsilon) { // If whole production can epsilon
-            firstSet.insert("e");
-            canDeriveEpsilon = true;
+    // Terminals that start production directly, and edges B -> A for FIRST(B) in FIRST(A)
+    sets.first.assign(count, TerminalSet(terminalCount));
+    vector<vector<int>> dependents(count);
+    for (int p = 0; p < g.productionCount(); p++) {
+        int a = g.lhs[p] - terminalCount;
+        for (int k = g.start[p]; k < g.start[p + 1]; k++) {
+            int symbol = g.symbols[k];
+            if (!symbols.isNonTerminal(symbol)) {
+                sets.first[a].insert(symbol);
+                break;
+            }
+            int b = symbol - terminalCount;
+            if (b != a) dependents[b].push_back(a);
+            if (!sets.nullable[b]) break;
         }
     }
+    for (auto& list : dependents) {
+        sort(list.begin(), list.end());
+        list.erase(unique(list.begin(), list.end()), list.end());
+    }
 
-    return canDeriveEpsilon;
-}
-
-// Function to compute first sets for all non-terminals
-map<string, set<string>> computeFirstSets(const Grammar& grammar) {
-    map<string, set<string>> firstSets;
+    if (jobs > 1) {
+        closeSetsByComponents(dependents, sets.first, jobs);
+        return sets;
+    }
 
-    for (const auto& entry : grammar.productions) { // For every non-terminal
-        string nonTerminal = entry.first;
-        set<string> firstSet;
-        calculateFirstDFS(nonTerminal, nonTerminal, nonTerminal, grammar.productions, firstSet);
-        firstSets[nonTerminal] = firstSet; // Save first set
+    // Push sets along edges until nothing change
+    vector<bool> queued(count, true);
+    for (int i = 0; i < count; i++) worklist.push_back(i);
+    while (!worklist.empty()) {
+        int b = worklist.back();
+        worklist.pop_back();
+        queued[b] = false;
+        for (int a : dependents[b]) {
+            if (sets.first[a].unionWith(sets.first[b]) && !queued[a]) {
+                queued[a] = true;
+                worklist.push_back(a);
+            }
+        }
     }
 
-    return firstSets;
+    return sets;
 }
 
+// Function for find FOLLOW sets. Each production is walked one time from right to
+// left: what can come after B go direct in FOLLOW(B), and if rest can be epsilon
+// we add edge A -> B. Then FOLLOW(A) flow along edges, just OR of words per edge
+// (over components on many threads when jobs more than 1)
+vector<TerminalSet> computeFollowSets(const Grammar& grammar, const SymbolTable& symbols,
+                                      const GrammarSets& sets, int jobs = 1) {
+    const IdGrammar g = toIdGrammar(grammar, symbols);
+    const int terminalCount = symbols.terminalCount;
+    const int count = symbols.nonTerminalCount();
 
-// Function for find FOLLOW sets
-map<string, set<string>> computeFollowSets(const Grammar& grammar, const map<string, set<string>>& firstSets) {
-    map<string, set<string>> followSets; // we making map for FOLLOW set
+    vector<TerminalSet> follow(count, TerminalSet(terminalCount));
+    vector<vector<int>> inheritors(count); // FOLLOW(A) must go into FOLLOW(B) for B in list
 
     // For start symbol we put $ because it should end
-    followSets[grammar.startSymbol].insert("$");
+    follow[symbols.find(grammar.startSymbol) - terminalCount].insert(symbols.find("$"));
+
+    TerminalSet rest(terminalCount); // FIRST of what come after current symbol
+    for (int p = 0; p < g.productionCount(); p++) {
+        int a = g.lhs[p] - terminalCount;
+        rest.clear();
+        bool restNullable = true;
+        for (int k = g.start[p + 1] - 1; k >= g.start[p]; k--) {
+            int symbol = g.symbols[k];
+            if (!symbols.isNonTerminal(symbol)) {
+                rest.clear();
+                rest.insert(symbol);
+                restNullable = false;
+                continue;
+            }
+            int b = symbol - terminalCount;
+            follow[b].unionWith(rest);
+            if (restNullable && b != a) inheritors[a].push_back(b);
 
-    // We keep doing until nothing change
-    bool changed = true;
-    while (changed) {
-        changed = false;
+            if (!sets.nullable[b]) rest.clear();
+            rest.unionWith(sets.first[b]);
+            restNullable = restNullable && sets.nullable[b];
+        }
+    }
+    for (auto& list : inheritors) {
+        sort(list.begin(), list.end());
+        list.erase(unique(list.begin(), list.end()), list.end());
+    }
 
-        for (const auto& entry : grammar.productions) { // look for every non-terminal
-            string nonTerminal = entry.first;
-
-            for (const auto& production : entry.second) { // look every rule of non-terminal
-                for (size_t i = 0; i < production.size(); i++) {
-                    // We only care if it non-terminal
-                    if (production[i][0] >= 'A' && production[i][0] <= 'Z') {
-                        string B = production[i]; // B is that non-terminal
-
-                        // if after B there is something
-                        if (i + 1 < production.size()) {
-                            string next = production[i + 1];
-
-                            // if next is terminal, add it in FOLLOW(B)
-                            if (!(next[0] >= 'A' && next[0] <= 'Z')) {
-                                if (next != "e" && followSets[B].insert(next).second) {
-                                    changed = true; // something new added
-                                }
-                            }
-                            // if next is also non-terminal
-                            else {
-                                // add FIRST(next) to FOLLOW(B) but not epsilon
-                                for (const string& c : firstSets.at(next)) {
-                                    if (c != "e" && followSets[B].insert(c).second) {
-                                        changed = true;
-                                    }
-                                }
-
-                                // if FIRST(next) got epsilon, check further
-                                if (firstSets.at(next).find("e") != firstSets.at(next).end()) {
-                                    bool allCanDeriveEpsilon = true;
-
-                                    for (size_t j = i + 1; j < production.size(); j++) {
-                                        string symbol = production[j];
-
-                                        if (!(symbol[0] >= 'A' && symbol[0] <= 'Z')) { // if terminal
-                                            if (symbol != "e") {
-                                                if (followSets[B].insert(symbol).second) {
-                                                    changed = true;
-                                                }
-                                            }
-                                            allCanDeriveEpsilon = (symbol == "e");
-                                            break;
-                                        }
-
-                                        // Add terminals from FIRST(symbol)
-                                        bool canDeriveEpsilon = false;
-                                        for (const string& c : firstSets.at(symbol)) {
-                                            if (c == "e") {
-                                                canDeriveEpsilon = true;
-                                            } else if (followSets[B].insert(c).second) {
-                                                changed = true;
-                                            }
-                                        }
-
-                                        // if symbol cannot give epsilon, no need go further
-                                        if (!canDeriveEpsilon) {
-                                            allCanDeriveEpsilon = false;
-                                            break;
-                                        }
-                                    }
-
-                                    // if everything after can give epsilon, add FOLLOW(A) to FOLLOW(B)
-                                    if (allCanDeriveEpsilon) {
-                                        for (const string& c : followSets[nonTerminal]) {
-                                            if (followSets[B].insert(c).second) {
-                                                changed = true;
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        // if B is last symbol
-                        else {
-                            // Add FOLLOW(A) to FOLLOW(B)
-                            for (const string& c : followSets[nonTerminal]) {
-                                if (followSets[B].insert(c).second) {
-                                    changed = true;
-                                }
-                            }
-                        }
-                    }
-                }
+    if (jobs > 1) {
+        closeSetsByComponents(inheritors, follow, jobs);
+        return follow;
+    }
+
+    // We keep doing until nothing change
+    vector<int> worklist;
+    vector<bool> queued(count, true);
+    for (int i = 0; i < count; i++) worklist.push_back(i);
+    while (!worklist.empty()) {
+        int a = worklist.back();
+        worklist.pop_back();
+        queued[a] = false;
+        for (int b : inheritors[a]) {
+            if (follow[b].unionWith(follow[a]) && !queued[b]) {
+                queued[b] = true;
+                worklist.push_back(b);
             }
         }
     }
 
-    return followSets; // return final FOLLOW sets
+    return follow; // return final FOLLOW sets
 }
 
-// Function for removing left recursion
-Grammar removeLeftRecursion(const Grammar& original) {
-    Grammar result = original;
+// Productions kept hash-consed while removing left recursion. A production is a
+// list of cells (symbol, rest of list) and every cell is made only one time, so
+// the same suffix is stored once and shared, and equal productions get equal id
+class ProductionPool {
+private:
+    vector<string> names; // Symbol index -> name
+    unordered_map<string, int> symbolIndex;
+    vector<pair<int, int>> cells; // (symbol, rest) for each list id
+    unordered_map<uint64_t, int> cellIndex;
+
+public:
+    static const int EMPTY = -1; // List with nothing, it is epsilon
+
+    int symbol(const string& name) { // Index for symbol name
+        auto it = symbolIndex.find(name);
+        if (it != symbolIndex.end()) return it->second;
+        symbolIndex[name] = (int)names.size();
+        names.push_back(name);
+        return (int)names.size() - 1;
+    }
+
+    int cons(int head, int rest) { // List with head in front of rest
+        uint64_t key = ((uint64_t)(uint32_t)head << 32) | (uint32_t)rest;
+        auto it = cellIndex.find(key);
+        if (it != cellIndex.end()) return it->second;
+        cellIndex[key] = (int)cells.size();
+        cells.push_back({head, rest});
+        return (int)cells.size() - 1;
+    }
+
+    int head(int list) const { return cells[list].first; }
+    int rest(int list) const { return cells[list].second; }
+
+    int fromProduction(const vector<string>& production) { // "e" become empty list
+        int list = EMPTY;
+        for (auto it = production.rbegin(); it != production.rend(); ++it) {
+            if (*it != "e") list = cons(symbol(*it), list);
+        }
+        return list;
+    }
+
+    int concat(int front, int back) { // Only cells of front are made again, back is shared
+        vector<int> symbols;
+        for (int list = front; list != EMPTY; list = rest(list)) symbols.push_back(head(list));
+        for (auto it = symbols.rbegin(); it != symbols.rend(); ++it) back = cons(*it, back);
+        return back;
+    }
+
+    vector<string> toProduction(int list) const {
+        if (list == EMPTY) return {"e"};
+        vector<string> production;
+        for (; list != EMPTY; list = rest(list)) production.push_back(names[head(list)]);
+        return production;
+    }
+};
+
+// Function for removing left recursion. Only non-terminals in a cycle of the
+// left-corner graph (A -> B when some production of A start with B) can be left
+// recursive, so substitution is done only inside those components and the rest
+// of grammar is not touched. Grammar is changed in place
+void removeLeftRecursion(Grammar& grammar) {
     bool hadLeftRecursion = false; // flag for if we found left recursion
 
-    // We store all non-terminals in a vector
+    // We store all non-terminals in a vector, map keep them sorted already
     vector<string> nonTerminals;
-    for (const auto& entry : result.productions) {
+    map<string, int> index;
+    for (const auto& entry : grammar.productions) {
+        index[entry.first] = (int)nonTerminals.size();
         nonTerminals.push_back(entry.first);
     }
 
-    // Sort to make sure same order always
-    sort(nonTerminals.begin(), nonTerminals.end());
-
-    // Algorithm to remove left recursion
-    for (const string& Ai : nonTerminals) {
-        // Look at all non-terminals before Ai
-        for (const string& Aj : nonTerminals) {
-            if (Aj >= Ai) break;
+    // Left-corner graph
+    vector<vector<int>> leftCorner(nonTerminals.size());
+    vector<bool> selfLoop(nonTerminals.size(), false);
+    for (const auto& entry : grammar.productions) {
+        int a = index[entry.first];
+        for (const auto& production : entry.second) {
+            if (production.empty()) continue;
+            auto it = index.find(production[0]);
+            if (it == index.end()) continue;
+            if (it->second == a) selfLoop[a] = true;
+            leftCorner[a].push_back(it->second);
+        }
+    }
 
-            vector<vector<string>> newProductions;
+    ProductionPool pool;
+    for (vector<int>& component : stronglyConnectedComponents(leftCorner)) {
+        if (component.size() == 1 && !selfLoop[component[0]]) continue; // No left recursion here
+        sort(component.begin(), component.end()); // Same order as before, by name
 
-            // Replace Ai -> Aj γ with Ai -> δ γ
-            for (const auto& production : result.productions[Ai]) {
-                if (!production.empty() && production[0] == Aj) {
-                    // production start with Aj
-                    vector<string> gamma(production.begin() + 1, production.end());
+        // Productions of this component as list ids
+        map<int, vector<int>> lists;
+        for (int a : component) {
+            for (const auto& production : grammar.productions[nonTerminals[a]]) {
+                lists[a].push_back(pool.fromProduction(production));
+            }
+        }
 
-                    for (const auto& deltaProduction : result.productions[Aj]) {
-                        vector<string> newProduction = deltaProduction;
-                        newProduction.insert(newProduction.end(), gamma.begin(), gamma.end());
-                        newProductions.push_back(newProduction);
+        for (size_t i = 0; i < component.size(); i++) {
+            const string& Ai = nonTerminals[component[i]];
+            int aiSymbol = pool.symbol(Ai);
+
+            // Look at non-terminals of component before Ai, replace Ai -> Aj γ with Ai -> δ γ
+            for (size_t j = 0; j < i; j++) {
+                int ajSymbol = pool.symbol(nonTerminals[component[j]]);
+                vector<int> newProductions;
+                for (int production : lists[component[i]]) {
+                    if (production != ProductionPool::EMPTY && pool.head(production) == ajSymbol) {
+                        int gamma = pool.rest(production);
+                        for (int delta : lists[component[j]]) {
+                            newProductions.push_back(pool.concat(delta, gamma));
+                        }
+                    } else {
+                        newProductions.push_back(production); // keep same production
                     }
-                } else {
-                    // keep same production
-                    newProductions.push_back(production);
                 }
+                lists[component[i]] = newProductions;
             }
 
-            result.productions[Ai] = newProductions;
-        }
-
-        // Now remove direct left recursion in Ai
-        vector<vector<string>> alphaProductions;  // production like Ai -> Ai a
-        vector<vector<string>> betaProductions;   // production like Ai -> β
+            // Now remove direct left recursion in Ai. Same list id mean same production
+            vector<int> alphaProductions; // production like Ai -> Ai a
+            vector<int> betaProductions; // production like Ai -> β
+            set<int> seen;
+            for (int production : lists[component[i]]) {
+                if (!seen.insert(production).second) continue;
+                if (production != ProductionPool::EMPTY && pool.head(production) == aiSymbol) {
+                    alphaProductions.push_back(pool.rest(production));
+                } else {
+                    betaProductions.push_back(production);
+                }
+            }
 
-        for (const auto& production : result.productions[Ai]) {
-            if (!production.empty() && production[0] == Ai) {
-                // this production have left recursion
-                hadLeftRecursion = true;
-                vector<string> alpha(production.begin() + 1, production.end());
-                alphaProductions.push_back(alpha);
-            } else {
-                // no left recursion here
-                betaProductions.push_back(production);
+            if (alphaProductions.empty()) {
+                lists[component[i]] = betaProductions;
+                continue;
             }
-        }
+            hadLeftRecursion = true;
 
-        if (!alphaProductions.empty()) {
             // Create new non-terminal like Ai'
             string newNonTerminal = Ai + "'";
-            while (result.productions.find(newNonTerminal) != result.productions.end()) {
+            while (grammar.productions.find(newNonTerminal) != grammar.productions.end()) {
                 newNonTerminal += "'";
             }
+            int prime = pool.cons(pool.symbol(newNonTerminal), ProductionPool::EMPTY);
 
-            // New rules: Ai -> β Ai' and Ai' -> a Ai' | e
-            vector<vector<string>> newAiProductions;
-            vector<vector<string>> newAiPrimeProductions;
-
-            for (const auto& beta : betaProductions) {
-                vector<string> newProduction = beta;
-                if (beta.size() == 1 && beta[0] == "e") {
-                    newProduction = {newNonTerminal};
-                } else {
-                    newProduction.push_back(newNonTerminal);
-                }
-                newAiProductions.push_back(newProduction);
+            // New rules: Ai -> β Ai' and Ai' -> a Ai' | e. If no beta, Ai -> Ai'
+            vector<int> newAiProductions;
+            for (int beta : betaProductions) {
+                newAiProductions.push_back(pool.concat(beta, prime));
             }
-
-            // If no beta, add Ai -> Ai'
             if (betaProductions.empty()) {
-                newAiProductions.push_back({newNonTerminal});
+                newAiProductions.push_back(prime);
             }
 
-            for (const auto& alpha : alphaProductions) {
-                vector<string> newProduction = alpha;
-                newProduction.push_back(newNonTerminal);
-                newAiPrimeProductions.push_back(newProduction);
+            vector<vector<string>>& newAiPrimeProductions = grammar.productions[newNonTerminal];
+            for (int alpha : alphaProductions) {
+                newAiPrimeProductions.push_back(pool.toProduction(pool.concat(alpha, prime)));
             }
+            newAiPrimeProductions.push_back({"e"}); // add epsilon to Ai'
 
-            // add epsilon to Ai'
-            newAiPrimeProductions.push_back({"e"});
+            lists[component[i]] = newAiProductions;
+        }
 
-            result.productions[Ai] = newAiProductions;
-            result.productions[newNonTerminal] = newAiPrimeProductions;
-            nonTerminals.push_back(newNonTerminal);
+        // Write component back to grammar
+        for (int a : component) {
+            vector<vector<string>>& productions = grammar.productions[nonTerminals[a]];
+            productions.clear();
+            for (int list : lists[a]) productions.push_back(pool.toProduction(list));
         }
     }
 
@@ -508,313 +1134,2751 @@ Grammar removeLeftRecursion(const Grammar& original) {
     } else {
         cout << "\nNo left recursion found." << endl;
     }
-
-    return result;
 }
 
-// Function for printing FIRST and FOLLOW sets
-void printSets(const map<string, set<string>>& sets, const string& title) {
-    cout << "\n" << title << ":" << endl;
-    for (const auto& entry : sets) {
-        cout << entry.first << " = {";
-        bool first = true;
-        for (const string& symbol : entry.second) {
-            if (!first) cout << ",";
-            cout << symbol;
-            first = false;
+// Simplification passes, run after left recursion removal and before table. Each pass
+// change grammar in place and keep the language same; none of them can make new LL(1)
+// conflict (FIRST of productions stay same and FOLLOW sets only get smaller or merge
+// sets of same shape). Parse then need fewer expansions per token
+const int INLINE_MAX_LENGTH = 4; // Longest production inlined into its uses
+const int INLINE_MAX_RESULT = 32; // Do not make productions longer than this
+const int UNIT_MAX_ALTERNATIVES = 8; // A -> B is replaced only if B have this many or less
+
+// Size of grammar, printed before and after each pass
+struct GrammarSize {
+    int nonTerminals = 0;
+    int productions = 0;
+    int symbols = 0; // All symbols on right sides
+    long shortestExpansions = -1; // Expansions to derive shortest sentence, -1 if none
+};
+
+GrammarSize measureGrammar(const Grammar& grammar) {
+    GrammarSize size;
+    size.nonTerminals = (int)grammar.productions.size();
+    for (const auto& [lhs, alternatives] : grammar.productions) {
+        size.productions += (int)alternatives.size();
+        for (const auto& production : alternatives) size.symbols += (int)production.size();
+    }
+
+    // Fewest expansions for each non-terminal, repeat until nothing get smaller
+    const long unknown = numeric_limits<long>::max();
+    map<string, long> fewest;
+    for (const auto& entry : grammar.productions) fewest[entry.first] = unknown;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            for (const auto& production : alternatives) {
+                long total = 1;
+                for (const string& symbol : production) {
+                    if (!isNonTerminalName(symbol)) continue;
+                    auto found = fewest.find(symbol);
+                    if (found == fewest.end() || found->second == unknown) {
+                        total = unknown;
+                        break;
+                    }
+                    total += found->second;
+                }
+                if (total < fewest[lhs]) {
+                    fewest[lhs] = total;
+                    changed = true;
+                }
+            }
         }
-        cout << "}" << endl;
     }
+    auto start = fewest.find(grammar.startSymbol);
+    if (start != fewest.end() && start->second != unknown) size.shortestExpansions = start->second;
+    return size;
 }
 
+// Take out "e" from production, empty one become just "e"
+void normalizeProduction(vector<string>& production) {
+    production.erase(remove(production.begin(), production.end(), "e"), production.end());
+    if (production.empty()) production.push_back("e");
+}
 
-// Make LL(1) parsing table
-ParseTable constructLL1Table(const Grammar& grammar,
-    const map<string, set<string>>& firstSets,
-    const map<string, set<string>>& followSets) {
-cout << "\nConstructing LL(1) Parsing Table..." << endl;
-
-ParseTable table;
+// Remove non-terminals which can not give any terminal string (with productions using
+// them), then non-terminals which can not be reached from start symbol
+void removeDeadSymbols(Grammar& grammar) {
+    set<string> productive;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            if (productive.count(lhs)) continue;
+            for (const auto& production : alternatives) {
+                if (all_of(production.begin(), production.end(), [&](const string& symbol) {
+                        return !isNonTerminalName(symbol) || productive.count(symbol);
+                    })) {
+                    productive.insert(lhs);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    if (!productive.count(grammar.startSymbol)) return; // Language is empty, leave it
 
-// Find all terminal from grammar
-set<string> terminals;
-for (const auto& entry : firstSets) {
-for (const string& terminal : entry.second) {
-if (terminal != "e") {
-terminals.insert(terminal);
-}
+    for (auto it = grammar.productions.begin(); it != grammar.productions.end(); ) {
+        if (!productive.count(it->first)) {
+            it = grammar.productions.erase(it);
+            continue;
+        }
+        auto& alternatives = it->second;
+        alternatives.erase(remove_if(alternatives.begin(), alternatives.end(), [&](const vector<string>& production) {
+            return any_of(production.begin(), production.end(), [&](const string& symbol) {
+                return isNonTerminalName(symbol) && !productive.count(symbol);
+            });
+        }), alternatives.end());
+        ++it;
+    }
+
+    set<string> reachable = {grammar.startSymbol};
+    vector<string> pending = {grammar.startSymbol};
+    while (!pending.empty()) {
+        string current = pending.back();
+        pending.pop_back();
+        for (const auto& production : grammar.productions[current]) {
+            for (const string& symbol : production) {
+                if (isNonTerminalName(symbol) && reachable.insert(symbol).second) pending.push_back(symbol);
+            }
+        }
+    }
+    for (auto it = grammar.productions.begin(); it != grammar.productions.end(); ) {
+        if (reachable.count(it->first)) ++it;
+        else it = grammar.productions.erase(it);
+    }
 }
+
+// Replace every use of non-terminal with its production
+void substituteSymbol(Grammar& grammar, const string& name, const vector<string>& replacement) {
+    for (auto& [lhs, alternatives] : grammar.productions) {
+        for (auto& production : alternatives) {
+            if (find(production.begin(), production.end(), name) == production.end()) continue;
+            vector<string> result;
+            for (string& symbol : production) {
+                if (symbol == name) result.insert(result.end(), replacement.begin(), replacement.end());
+                else result.push_back(move(symbol));
+            }
+            normalizeProduction(result);
+            production = move(result);
+        }
+    }
 }
-for (const auto& entry : followSets) {
-for (const string& terminal : entry.second) {
-terminals.insert(terminal);
+
+// Epsilon tails: non-terminal with only "e" is erased from right sides, and nullable
+// non-terminals with same productions (like two X' -> + T X' | e) become one
+void mergeEpsilonTails(Grammar& grammar) {
+    for (auto it = grammar.productions.begin(); it != grammar.productions.end(); ) {
+        bool onlyEpsilon = !it->second.empty() && all_of(it->second.begin(), it->second.end(),
+            [](const vector<string>& production) { return production.size() == 1 && production[0] == "e"; });
+        if (!onlyEpsilon || it->first == grammar.startSymbol) {
+            ++it;
+            continue;
+        }
+        string name = it->first;
+        it = grammar.productions.erase(it);
+        substituteSymbol(grammar, name, {"e"});
+    }
+
+    // Shape of nullable non-terminal: its sorted productions, own name written as @
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        map<vector<vector<string>>, string> byShape;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            bool nullable = any_of(alternatives.begin(), alternatives.end(),
+                [](const vector<string>& production) { return production.size() == 1 && production[0] == "e"; });
+            if (!nullable) continue;
+            vector<vector<string>> shape = alternatives;
+            for (auto& production : shape) replace(production.begin(), production.end(), lhs, string("@"));
+            sort(shape.begin(), shape.end());
+
+            auto [found, added] = byShape.emplace(shape, lhs);
+            if (added) continue;
+            // Keep start symbol if it is one of them, else the first name
+            string keep = found->second, drop = lhs;
+            if (drop == grammar.startSymbol) swap(keep, drop);
+            grammar.productions.erase(drop);
+            substituteSymbol(grammar, drop, {keep});
+            merged = true;
+            break; // Map changed, look again
+        }
+    }
 }
+
+// Unit chains: non-terminal with one short production is put into its uses (so E -> T E'
+// and T -> F T' need no own expand), and unit production A -> B get B's productions
+void inlineUnitProductions(Grammar& grammar) {
+    set<string> done;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [name, alternatives] : grammar.productions) {
+            if (done.count(name) || alternatives.size() != 1) continue;
+            const vector<string>& body = alternatives[0];
+            if ((int)body.size() > INLINE_MAX_LENGTH || find(body.begin(), body.end(), name) != body.end()) continue;
+
+            // Check no use get too long
+            bool fits = true;
+            for (const auto& [lhs, others] : grammar.productions) {
+                for (const auto& production : others) {
+                    long uses = count(production.begin(), production.end(), name);
+                    if (uses && (long)production.size() + uses * ((long)body.size() - 1) > INLINE_MAX_RESULT) fits = false;
+                }
+            }
+            done.insert(name);
+            if (!fits) continue;
+
+            vector<string> replacement = body;
+            string inlined = name;
+            substituteSymbol(grammar, inlined, replacement);
+            if (inlined != grammar.startSymbol) grammar.productions.erase(inlined);
+            changed = true;
+            break; // Map changed, look again
+        }
+    }
+
+    for (auto& [name, alternatives] : grammar.productions) {
+        for (size_t i = 0; i < alternatives.size(); i++) {
+            if (alternatives[i].size() != 1 || !isNonTerminalName(alternatives[i][0])) continue;
+            const string target = alternatives[i][0];
+            auto found = grammar.productions.find(target);
+            if (target == name || found == grammar.productions.end()) continue;
+            const auto& targetAlternatives = found->second;
+            if ((int)targetAlternatives.size() > UNIT_MAX_ALTERNATIVES) continue;
+            bool loops = any_of(targetAlternatives.begin(), targetAlternatives.end(), [&](const vector<string>& production) {
+                return production.size() == 1 && (production[0] == name || production[0] == target);
+            });
+            if (loops) continue;
+
+            vector<vector<string>> replacement = targetAlternatives;
+            alternatives.erase(alternatives.begin() + i);
+            alternatives.insert(alternatives.begin() + i, replacement.begin(), replacement.end());
+            i += replacement.size() - 1;
+        }
+    }
 }
 
-// For every non-terminal
-for (const auto& entry : grammar.productions) {
-string nonTerminal = entry.first;
+// Same production twice for one non-terminal, keep first
+void removeDuplicateProductions(Grammar& grammar) {
+    for (auto& [lhs, alternatives] : grammar.productions) {
+        set<vector<string>> seen;
+        alternatives.erase(remove_if(alternatives.begin(), alternatives.end(), [&](const vector<string>& production) {
+            return !seen.insert(production).second;
+        }), alternatives.end());
+    }
+}
 
-// See all production rules
-for (size_t i = 0; i < entry.second.size(); i++) {
-const vector<string>& production = entry.second[i];
+// Run all passes in order and show what each did
+void simplifyGrammar(Grammar& grammar) {
+    struct Pass {
+        const char* name;
+        void (*run)(Grammar&);
+    };
+    const Pass passes[] = {
+        {"dead-symbols", removeDeadSymbols},
+        {"epsilon-tails", mergeEpsilonTails},
+        {"unit-inlining", inlineUnitProductions},
+        {"duplicate-productions", removeDuplicateProductions},
+        {"dead-symbols", removeDeadSymbols},
+    };
+
+    auto expansions = [](long value) { return value < 0 ? string("-") : to_string(value); };
+    cout << "\nSimplification Passes:" << endl;
+    for (const Pass& pass : passes) {
+        GrammarSize before = measureGrammar(grammar);
+        pass.run(grammar);
+        GrammarSize after = measureGrammar(grammar);
+        cout << "  " << left << setw(22) << pass.name << right
+             << " non-terminals " << before.nonTerminals << " -> " << after.nonTerminals
+             << ", productions " << before.productions << " -> " << after.productions
+             << ", symbols " << before.symbols << " -> " << after.symbols
+             << ", shortest sentence expansions " << expansions(before.shortestExpansions)
+             << " -> " << expansions(after.shortestExpansions) << endl;
+    }
+}
 
-// Get FIRST set for production
-set<string> productionFirst;
-bool canDeriveEpsilon = true;
+// Function for printing FIRST and FOLLOW sets. If nullable given, "e" is shown too
+void printSets(const SymbolTable& symbols, const vector<TerminalSet>& sets,
+               const vector<bool>* nullable, const string& title) {
+    cout << "\n" << title << ":" << endl;
+    for (int i = 0; i < (int)sets.size(); i++) {
+        // Terminal ids are in sorted order, "e" just need to go in right place
+        vector<string> names;
+        sets[i].forEach([&](int t) { names.push_back(symbols.name(t)); });
+        if (nullable && (*nullable)[i]) {
+            names.insert(lower_bound(names.begin(), names.end(), string("e")), "e");
+        }
 
-for (const string& symbol : production) {
-if (symbol == "e") {
-productionFirst.insert("e");
-break;
+        cout << symbols.name(symbols.terminalCount + i) << " = {";
+        for (size_t k = 0; k < names.size(); k++) {
+            if (k > 0) cout << ",";
+            cout << names[k];
+        }
+        cout << "}" << endl;
+    }
 }
 
-if (!(symbol[0] >= 'A' && symbol[0] <= 'Z')) {
-productionFirst.insert(symbol);
-canDeriveEpsilon = false;
-break;
+// Make production into string like A->B c
+string productionToString(const ParseTable& table, int p) {
+    string result = table.symbols.name(table.productionLhs[p]) + "->";
+    if (table.productionBegin(p) == table.productionEnd(p)) {
+        return result + "e"; // Epsilon production
+    }
+    for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+        if (it != table.productionBegin(p)) result += " ";
+        result += table.symbols.name(*it);
+    }
+    return result;
 }
 
-bool symbolCanDeriveEpsilon = false;
-for (const string& c : firstSets.at(symbol)) {
-if (c == "e") {
-   symbolCanDeriveEpsilon = true;
-} else {
-   productionFirst.insert(c);
+// Make LL(1) parsing table. Every row is filled only from productions of its own
+// non-terminal, so with more jobs rows are filled on many threads. Warnings are kept
+// per row and printed in row order, output is same as with one thread
+ParseTable constructLL1Table(const Grammar& grammar, const SymbolTable& symbols, const GrammarSets& sets,
+                             int jobs = 1) {
+    cout << "\nConstructing LL(1) Parsing Table..." << endl;
+
+    ParseTable table;
+    table.symbols = symbols;
+    table.startSymbol = symbols.find(grammar.startSymbol);
+    table.endMarker = symbols.find("$");
+
+    // Productions go in pool as they are
+    IdGrammar g = toIdGrammar(grammar, symbols);
+    table.productionLhs = move(g.lhs);
+    table.productionStart = move(g.start);
+    table.pool = move(g.symbols);
+
+    const int terminalCount = symbols.terminalCount;
+    table.cells.assign((size_t)symbols.nonTerminalCount() * terminalCount, NO_PRODUCTION);
+
+    // Productions of one non-terminal are next to each other in pool, row r have
+    // productions rowStart[r] until rowStart[r + 1]
+    vector<int> rowStart;
+    for (int p = 0; p < table.productionCount(); p++) {
+        if (p == 0 || table.productionLhs[p] != table.productionLhs[p - 1]) rowStart.push_back(p);
+    }
+    const int rowCount = (int)rowStart.size();
+    rowStart.push_back(table.productionCount());
+    vector<string> warnings(rowCount);
+    vector<int> rowConflicts(rowCount, 0);
+
+    // Put one cell of table, warn if already taken. Same production put again (epsilon
+    // production on FOLLOW) still warn like before, but it is not counted as conflict
+    auto setCell = [&](int row, int nonTerminal, int terminal, int p) {
+        int& cell = table.cells[(size_t)(nonTerminal - terminalCount) * terminalCount + terminal];
+        if (cell != NO_PRODUCTION) {
+            warnings[row] += "Warning: Grammar not LL(1)! Conflict at [" + symbols.name(nonTerminal)
+                           + ", " + symbols.name(terminal) + "]\n";
+            if (cell != p) rowConflicts[row]++;
+        }
+        cell = p;
+    };
+
+    // Fill rows from firstRow until lastRow (not included)
+    auto fillRows = [&](int firstRow, int lastRow) {
+        TerminalSet productionFirst(terminalCount);
+        for (int row = firstRow; row < lastRow; row++) {
+            for (int p = rowStart[row]; p < rowStart[row + 1]; p++) {
+                int nonTerminal = table.productionLhs[p];
+                const TerminalSet& follow = sets.follow[nonTerminal - terminalCount];
+
+                // Get FIRST set for production
+                productionFirst.clear();
+                bool canDeriveEpsilon = true;
+                for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+                    if (!symbols.isNonTerminal(*it)) {
+                        productionFirst.insert(*it);
+                        canDeriveEpsilon = false;
+                        break;
+                    }
+                    productionFirst.unionWith(sets.first[*it - terminalCount]);
+                    if (!sets.nullable[*it - terminalCount]) {
+                        canDeriveEpsilon = false;
+                        break;
+                    }
+                }
+
+                // If production can go to epsilon, add FOLLOW set too
+                if (canDeriveEpsilon) {
+                    productionFirst.unionWith(follow);
+                }
+
+                // Now fill the table
+                productionFirst.forEach([&](int terminal) { setCell(row, nonTerminal, terminal, p); });
+
+                // Handle if production is epsilon, put it in table for FOLLOW symbols
+                if (canDeriveEpsilon) {
+                    follow.forEach([&](int terminal) { setCell(row, nonTerminal, terminal, p); });
+                }
+            }
+        }
+    };
+
+    if (jobs <= 1) {
+        fillRows(0, rowCount);
+    } else {
+        // Some chunks per worker, so the one who finish early can steal
+        TaskPool pool(jobs);
+        const int chunk = max(1, rowCount / (jobs * 8));
+        for (int first = 0; first < rowCount; first += chunk) {
+            int last = min(rowCount, first + chunk);
+            pool.push(0, [&fillRows, first, last](int) { fillRows(first, last); });
+        }
+        pool.run();
+    }
+    // Server and stream mode make cout silent, but conflict must still be seen
+    ostream& warningOut = cout ? cout : cerr;
+    for (const string& warning : warnings) warningOut << warning;
+    for (int conflicts : rowConflicts) table.conflicts += conflicts;
+
+    return table;
 }
+
+// Show the parsing table, only rows which have some entry and only columns of
+// terminals found in FIRST or FOLLOW sets
+void printLL1Table(const ParseTable& table, const GrammarSets& sets) {
+    const SymbolTable& symbols = table.symbols;
+    const int terminalCount = symbols.terminalCount;
+
+    TerminalSet terminals(terminalCount);
+    for (const TerminalSet& s : sets.first) terminals.unionWith(s);
+    for (const TerminalSet& s : sets.follow) terminals.unionWith(s);
+
+    cout.flush();
+    TraceOutput out(&cout);
+    out.put("\nLL(1) Parsing Table:\n");
+    out.pad(15);
+    terminals.forEach([&](int terminal) { out.putRight(symbols.name(terminal), 15); });
+    out.put('\n');
+
+    for (int nonTerminal = terminalCount; nonTerminal < (int)symbols.names.size(); nonTerminal++) {
+        const int* row = &table.cells[(size_t)(nonTerminal - terminalCount) * terminalCount];
+        if (all_of(row, row + terminalCount, [](int p) { return p == NO_PRODUCTION; })) continue;
+
+        out.putRight(symbols.name(nonTerminal), 15);
+        terminals.forEach([&](int terminal) {
+            int p = row[terminal];
+            out.putRight(p == NO_PRODUCTION ? "" : productionToString(table, p), 15);
+        });
+        out.put('\n');
+    }
 }
 
-if (!symbolCanDeriveEpsilon) {
-canDeriveEpsilon = false;
-break;
+// Compress table with row displacement. Every row get a base so its used cells fall
+// on free places of one shared array, first fit with fullest rows first. Lookup stay
+// O(1) and the mostly empty dense table is dropped
+void compressTable(ParseTable& table) {
+    const int terminalCount = table.symbols.terminalCount;
+    const int rowCount = table.symbols.nonTerminalCount();
+    if (rowCount == 0 || table.compressed()) return;
+
+    vector<vector<int>> columns(rowCount); // Used columns of each row
+    for (int row = 0; row < rowCount; row++) {
+        for (int t = 0; t < terminalCount; t++) {
+            if (table.cells[(size_t)row * terminalCount + t] != NO_PRODUCTION) columns[row].push_back(t);
+        }
+    }
+    vector<int> order(rowCount);
+    for (int row = 0; row < rowCount; row++) order[row] = row;
+    stable_sort(order.begin(), order.end(),
+                [&](int a, int b) { return columns[a].size() > columns[b].size(); });
+
+    vector<bool> taken;
+    size_t firstFree = 0; // Every place before this is taken
+    table.rowBase.assign(rowCount, 0);
+    for (int row : order) {
+        if (columns[row].empty()) continue; // Base 0, no place is ever owned by it
+        size_t base = firstFree > (size_t)columns[row][0] ? firstFree - columns[row][0] : 0;
+        while (true) {
+            bool fits = true;
+            for (int t : columns[row]) {
+                if (base + t < taken.size() && taken[base + t]) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits) break;
+            base++;
+        }
+        table.rowBase[row] = (int)base;
+        for (int t : columns[row]) {
+            if (base + t >= taken.size()) taken.resize(base + t + 1, false);
+            taken[base + t] = true;
+        }
+        while (firstFree < taken.size() && taken[firstFree]) firstFree++;
+    }
+
+    // Array is long enough that any base + terminal is inside it
+    size_t maxBase = *max_element(table.rowBase.begin(), table.rowBase.end());
+    table.packed.assign(maxBase + terminalCount, PackedCell{-1, NO_PRODUCTION});
+    for (int row = 0; row < rowCount; row++) {
+        for (int t : columns[row]) {
+            table.packed[table.rowBase[row] + t] = {row, table.cells[(size_t)row * terminalCount + t]};
+        }
+    }
+    table.cells.clear();
+    table.cells.shrink_to_fit();
 }
+
+// Cache file keep analyzed grammar, so next run no need to redo all the work.
+// File is header then int32 and uint64 sections one after other, so it can be mmap and used direct
+const char CACHE_MAGIC[4] = {'L', 'L', '1', 'C'};
+const uint32_t CACHE_VERSION = 4; // 4: trie left factoring give other transformed grammar
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t grammarHash; // Hash of grammar file this cache made from
+    uint32_t symbolCount, terminalCount, startSymbol, endMarker;
+    uint32_t nameBytes; // Size of all symbol names, padded to 4
+    uint32_t productionCount, poolSize, cellCount;
+    uint32_t packedSize; // Cells of compressed table, 0 if table is dense
+    uint32_t setWords; // 64-bit words in one FIRST or FOLLOW set
+};
+
+// FNV-1a hash of bytes, give previous hash to continue it
+uint64_t hashBytes(string_view data, uint64_t hash = 1469598103934665603ULL) {
+    for (char c : data) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+    }
+    return hash;
 }
 
-// If production can go to epsilon, add FOLLOW set too
-if (canDeriveEpsilon || (production.size() == 1 && production[0] == "e")) {
-productionFirst.insert("e");
-for (const string& c : followSets.at(nonTerminal)) {
-productionFirst.insert(c);
+// FNV-1a hash of whole file, 0 if file can not read
+uint64_t hashFile(const string& filename) {
+    ifstream fin(filename, ios::binary);
+    if (!fin) return 0;
+    uint64_t hash = hashBytes("");
+    char buffer[65536];
+    while (fin.read(buffer, sizeof(buffer)) || fin.gcount() > 0) {
+        hash = hashBytes(string_view(buffer, (size_t)fin.gcount()), hash);
+    }
+    return hash;
 }
+
+// Write analyzed grammar, FIRST/FOLLOW sets and parse table to cache file
+void saveAnalysisCache(const string& filename, uint64_t grammarHash, const ParseTable& table,
+                       const GrammarSets& sets) {
+    const SymbolTable& symbols = table.symbols;
+
+    // Names as offsets and characters
+    vector<int32_t> nameOffsets = {0};
+    string names;
+    for (const string& name : symbols.names) {
+        names += name;
+        nameOffsets.push_back((int32_t)names.size());
+    }
+    names.resize((names.size() + 3) / 4 * 4, '\0');
+
+    // Sets written as their raw words, nullable as one int per non-terminal
+    vector<int32_t> nullable(sets.nullable.begin(), sets.nullable.end());
+    auto setWords = [&](const vector<TerminalSet>& list) {
+        vector<uint64_t> words;
+        for (const TerminalSet& s : list) words.insert(words.end(), s.data().begin(), s.data().end());
+        return words;
+    };
+    vector<uint64_t> firstWords = setWords(sets.first), followWords = setWords(sets.follow);
+
+    CacheHeader header = {};
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.grammarHash = grammarHash;
+    header.symbolCount = (uint32_t)symbols.names.size();
+    header.terminalCount = (uint32_t)symbols.terminalCount;
+    header.startSymbol = (uint32_t)table.startSymbol;
+    header.endMarker = (uint32_t)table.endMarker;
+    header.nameBytes = (uint32_t)names.size();
+    header.productionCount = (uint32_t)table.productionCount();
+    header.poolSize = (uint32_t)table.pool.size();
+    header.cellCount = (uint32_t)table.cells.size();
+    header.packedSize = (uint32_t)table.packed.size();
+    header.setWords = (uint32_t)((symbols.terminalCount + 63) / 64);
+
+    // Write to temp file first, so half written cache never seen
+    string tempName = filename + ".tmp";
+    ofstream fout(tempName, ios::binary);
+    if (!fout) {
+        cerr << "Warning: Can not write cache file: " << filename << endl;
+        return;
+    }
+    auto writeInts = [&](const vector<int32_t>& v) {
+        fout.write((const char*)v.data(), v.size() * sizeof(int32_t));
+    };
+    fout.write((const char*)&header, sizeof(header));
+    writeInts(nameOffsets);
+    fout.write(names.data(), names.size());
+    writeInts(table.productionLhs);
+    writeInts(table.productionStart);
+    writeInts(table.pool);
+    writeInts(table.cells);
+    writeInts(table.rowBase);
+    fout.write((const char*)table.packed.data(), table.packed.size() * sizeof(PackedCell));
+    writeInts(nullable);
+    fout.write((const char*)firstWords.data(), firstWords.size() * sizeof(uint64_t));
+    fout.write((const char*)followWords.data(), followWords.size() * sizeof(uint64_t));
+    fout.close();
+    if (!fout || rename(tempName.c_str(), filename.c_str()) != 0) {
+        cerr << "Warning: Can not write cache file: " << filename << endl;
+        remove(tempName.c_str());
+    }
 }
 
-// Now fill the table
-for (const string& terminal : terminals) {
-if (productionFirst.find(terminal) != productionFirst.end()) {
-if (terminal != "e") {
-   // Conflict happen maybe
-   if (!table[nonTerminal][terminal].empty()) {
-       cout << "Warning: Grammar not LL(1)! Conflict at [" << nonTerminal << ", "
-            << terminal << "]" << endl;
-   }
+// Check every offset and id of loaded table is inside its array, so broken cache
+// file of right size can not make parser read out of range
+bool validCacheTable(const ParseTable& table, size_t nonTerminalCount) {
+    const int symbolCount = (int)table.symbols.names.size();
+    const int terminalCount = table.symbols.terminalCount;
+    const int productionCount = table.productionCount();
+    auto isSymbol = [&](int id) { return id >= 0 && id < symbolCount; };
+    auto isProduction = [&](int p) { return p == NO_PRODUCTION || (p >= 0 && p < productionCount); };
+
+    if (!isSymbol(table.startSymbol) || table.startSymbol < terminalCount) return false;
+    if (table.endMarker < 0 || table.endMarker >= terminalCount) return false;
+    for (int lhs : table.productionLhs) {
+        if (!isSymbol(lhs) || lhs < terminalCount) return false;
+    }
+    if (table.productionStart.front() != 0 || table.productionStart.back() != (int)table.pool.size()) return false;
+    for (int p = 0; p < productionCount; p++) {
+        if (table.productionStart[p] > table.productionStart[p + 1]) return false;
+    }
+    if (!all_of(table.pool.begin(), table.pool.end(), isSymbol)) return false;
 
-   table[nonTerminal][terminal] = production;
+    if (!table.compressed()) {
+        return table.cells.size() == nonTerminalCount * terminalCount &&
+               all_of(table.cells.begin(), table.cells.end(), isProduction);
+    }
+    for (int base : table.rowBase) {
+        if (base < 0 || (size_t)base + terminalCount > table.packed.size()) return false;
+    }
+    return all_of(table.packed.begin(), table.packed.end(), [&](const PackedCell& cell) {
+        return cell.row >= -1 && cell.row < (int)nonTerminalCount && isProduction(cell.production);
+    });
 }
+
+// Load cache file with mmap. Give false if no cache, or it is for other grammar or
+// other version, or something in it is out of range. Sets are only made when asked,
+// they are not needed for parsing
+bool loadAnalysisCache(const string& filename, uint64_t grammarHash, ParseTable& table,
+                       GrammarSets* sets = nullptr) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t fileSize = (size_t)info.st_size;
+    void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const char* data = (const char*)mapped;
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    // Size of sections from header counts, added in 64 bits with overflow check, so
+    // big counts can not wrap round and still match file size
+    bool overflow = header.terminalCount > header.symbolCount;
+    size_t nonTerminalCount = overflow ? 0 : header.symbolCount - header.terminalCount;
+    uint64_t expectedSize = sizeof(CacheHeader);
+    auto addSection = [&](uint64_t count, uint64_t elementSize) {
+        if (elementSize != 0 && count > (UINT64_MAX - expectedSize) / elementSize) overflow = true;
+        else expectedSize += count * elementSize;
+    };
+    addSection(header.nameBytes, 1);
+    addSection((uint64_t)header.symbolCount + 1, sizeof(int32_t));
+    addSection(header.productionCount, sizeof(int32_t));
+    addSection((uint64_t)header.productionCount + 1, sizeof(int32_t));
+    addSection(header.poolSize, sizeof(int32_t));
+    addSection(header.cellCount, sizeof(int32_t));
+    addSection(nonTerminalCount, sizeof(int32_t));
+    if (header.packedSize > 0) {
+        addSection(nonTerminalCount, sizeof(int32_t));
+        addSection(header.packedSize, sizeof(PackedCell));
+    }
+    addSection(2 * (uint64_t)nonTerminalCount, sizeof(uint64_t) * (uint64_t)header.setWords);
+    if (memcmp(header.magic, CACHE_MAGIC, 4) != 0 || header.version != CACHE_VERSION ||
+        header.grammarHash != grammarHash || overflow ||
+        header.setWords != (header.terminalCount + 63) / 64 ||
+        (uint64_t)fileSize != expectedSize) {
+        munmap(mapped, fileSize);
+        return false;
+    }
+
+    // Walk sections in same order they written
+    const char* cursor = data + sizeof(CacheHeader);
+    auto takeInts = [&](size_t count) {
+        const int32_t* start = (const int32_t*)cursor;
+        cursor += count * sizeof(int32_t);
+        return start;
+    };
+    const int32_t* nameOffsets = takeInts((size_t)header.symbolCount + 1);
+    const char* names = cursor;
+    cursor += header.nameBytes;
+    bool namesValid = nameOffsets[0] == 0 && nameOffsets[header.symbolCount] <= (int64_t)header.nameBytes;
+    for (uint32_t i = 0; namesValid && i < header.symbolCount; i++) {
+        namesValid = nameOffsets[i] <= nameOffsets[i + 1];
+    }
+    if (!namesValid) {
+        munmap(mapped, fileSize);
+        return false;
+    }
+
+    table = ParseTable();
+    for (uint32_t i = 0; i < header.symbolCount; i++) {
+        table.symbols.add(string(names + nameOffsets[i], names + nameOffsets[i + 1]));
+    }
+    table.symbols.terminalCount = (int)header.terminalCount;
+    table.startSymbol = (int)header.startSymbol;
+    table.endMarker = (int)header.endMarker;
+
+    const int32_t* section = takeInts(header.productionCount);
+    table.productionLhs.assign(section, section + header.productionCount);
+    section = takeInts((size_t)header.productionCount + 1);
+    table.productionStart.assign(section, section + (size_t)header.productionCount + 1);
+    section = takeInts(header.poolSize);
+    table.pool.assign(section, section + header.poolSize);
+    section = takeInts(header.cellCount);
+    table.cells.assign(section, section + header.cellCount);
+    if (header.packedSize > 0) {
+        section = takeInts(nonTerminalCount);
+        table.rowBase.assign(section, section + nonTerminalCount);
+        const PackedCell* packed = (const PackedCell*)cursor;
+        table.packed.assign(packed, packed + header.packedSize);
+        cursor += sizeof(PackedCell) * header.packedSize;
+    }
+    if (!validCacheTable(table, nonTerminalCount)) {
+        munmap(mapped, fileSize);
+        table = ParseTable();
+        return false;
+    }
+
+    if (sets) {
+        const int32_t* nullable = takeInts(nonTerminalCount);
+        sets->nullable.assign(nullable, nullable + nonTerminalCount);
+        auto takeSets = [&](vector<TerminalSet>& list) {
+            list.assign(nonTerminalCount, TerminalSet((int)header.terminalCount));
+            for (TerminalSet& s : list) {
+                memcpy(s.data().data(), cursor, header.setWords * sizeof(uint64_t));
+                cursor += header.setWords * sizeof(uint64_t);
+            }
+        };
+        takeSets(sets->first);
+        takeSets(sets->follow);
+    }
+
+    munmap(mapped, fileSize);
+    return true;
 }
+
+// Make string into C++ string literal
+string cppLiteral(const string& text) {
+    string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result + "\"";
 }
 
-// Handle if production is epsilon
-if (productionFirst.find("e") != productionFirst.end()) {
-for (const string& c : followSets.at(nonTerminal)) {
-if (!table[nonTerminal][c].empty()) {
-   cout << "Warning: Grammar not LL(1)! Conflict at [" << nonTerminal << ", "
-        << c << "]" << endl;
+// Write standalone C++ parser for this table. Grammar and table are baked in as
+// constant arrays and terminals are found with switch, so it need no map and no analysis
+void emitParser(const ParseTable& table, const string& filename, const string& grammarFile) {
+    ofstream fout(filename);
+    if (!fout) {
+        cerr << "Error open output file: " << filename << endl;
+        exit(1);
+    }
+
+    const SymbolTable& symbols = table.symbols;
+    const int terminalCount = symbols.terminalCount;
+    const int symbolCount = (int)symbols.names.size();
+
+    fout << "// LL(1) parser generated by a3.cpp from " << grammarFile << ". Do not edit.\n"
+         << "// Build: g++ -O2 -std=c++17 parser.cpp, run: ./a.out < input.txt\n"
+         << "#include <cctype>\n#include <iostream>\n#include <string>\n#include <string_view>\n#include <vector>\n\n"
+         << "using namespace std;\n\n";
+
+    fout << "const int TERMINAL_COUNT = " << terminalCount << ";\n"
+         << "const int START_SYMBOL = " << table.startSymbol << ";\n"
+         << "const int END_MARKER = " << table.endMarker << ";\n"
+         << "const int NO_PRODUCTION = -1;\n\n";
+
+    fout << "const char* const SYMBOL_NAMES[" << symbolCount << "] = {";
+    for (int i = 0; i < symbolCount; i++) {
+        fout << (i % 8 == 0 ? "\n    " : " ") << cppLiteral(symbols.name(i)) << ",";
+    }
+    fout << "\n};\n\n";
+
+    // Productions: where each start in pool, pool have one extra item so never empty
+    fout << "const int PRODUCTION_START[" << table.productionCount() + 1 << "] = {";
+    for (int p = 0; p <= table.productionCount(); p++) {
+        fout << (p % 16 == 0 ? "\n    " : " ") << table.productionStart[p] << ",";
+    }
+    fout << "\n};\n\nconst int PRODUCTION_SYMBOLS[" << table.pool.size() + 1 << "] = {";
+    for (size_t i = 0; i < table.pool.size(); i++) {
+        fout << (i % 16 == 0 ? "\n    " : " ") << table.pool[i] << ",";
+    }
+    fout << (table.pool.empty() ? "" : "\n   ") << " -1,\n};\n\n";
+
+    fout << "const int TABLE[" << symbols.nonTerminalCount() << "][" << terminalCount << "] = {\n";
+    for (int nt = terminalCount; nt < symbolCount; nt++) {
+        fout << "    {";
+        for (int t = 0; t < terminalCount; t++) {
+            fout << (t > 0 ? ", " : "") << table.lookup(nt, t);
+        }
+        fout << "}, // " << symbols.name(nt) << "\n";
+    }
+    fout << "};\n\n";
+
+    // Terminal lookup: switch on length, then compare with each name of that length
+    map<size_t, vector<int>> byLength;
+    for (int t = 0; t < terminalCount; t++) {
+        byLength[symbols.name(t).size()].push_back(t);
+    }
+    fout << "// Terminal id for token text, -1 if grammar not know it\n"
+         << "int terminalId(string_view text) {\n"
+         << "    switch (text.size()) {\n";
+    for (const auto& entry : byLength) {
+        fout << "    case " << entry.first << ":\n";
+        for (int t : entry.second) {
+            fout << "        if (text == " << cppLiteral(symbols.name(t)) << ") return " << t << ";\n";
+        }
+        fout << "        break;\n";
+    }
+    fout << "    }\n    return -1;\n}\n\n";
+
+    // Driver, same recovery as parseInput in a3.cpp
+    fout << R"(// Parse one line, print errors and give back number of errors
+int parseLine(string_view line, int lineNum, vector<int>& stack) {
+    stack.clear();
+    stack.push_back(END_MARKER);
+    stack.push_back(START_SYMBOL);
+
+    size_t pos = 0;
+    int errorCount = 0;
+    bool atMarker = false; // Token is the $ added after last token
+    bool atEnd = false; // Even $ is used
+    string_view text;
+    int token = 0;
+    vector<pair<int, size_t>> expanded; // Non-terminals expanded on this token, see a3.cpp
+    auto advance = [&]() {
+        expanded.clear();
+        if (atMarker) {
+            atEnd = true;
+            return;
+        }
+        while (pos < line.size() && isspace((unsigned char)line[pos])) pos++;
+        if (pos >= line.size()) {
+            text = "$";
+            token = END_MARKER;
+            atMarker = true;
+            return;
+        }
+        size_t start = pos;
+        while (pos < line.size() && !isspace((unsigned char)line[pos])) pos++;
+        text = line.substr(start, pos - start);
+        token = terminalId(text);
+    };
+    advance();
+
+    while (!stack.empty()) {
+        if (atEnd) {
+            cout << "Line " << lineNum << ": Error: Unexpected end of input\n";
+            errorCount++;
+            break;
+        }
+        int top = stack.back();
+        if (top == END_MARKER && token == END_MARKER) break;
+
+        if (top < TERMINAL_COUNT) {
+            if (top != token) {
+                cout << "Line " << lineNum << ": Error: Expected " << SYMBOL_NAMES[top] << " but found "
+                     << text << "\n";
+                errorCount++;
+            } else {
+                stack.pop_back();
+            }
+            advance();
+        } else {
+            int p = token < 0 ? NO_PRODUCTION : TABLE[top - TERMINAL_COUNT][token];
+            if (p != NO_PRODUCTION) { // Stop endless expansion of table with conflict
+                size_t depth = stack.size();
+                while (!expanded.empty() && expanded.back().second > depth) expanded.pop_back();
+                bool endless = false;
+                for (const auto& [nonTerminal, place] : expanded) {
+                    if (nonTerminal == top) {
+                        stack.resize(place - 1);
+                        endless = true;
+                        break;
+                    }
+                }
+                if (endless) {
+                    cout << "Line " << lineNum << ": Error: Endless expansion of " << SYMBOL_NAMES[top] << " on "
+                         << text << "\n";
+                    errorCount++;
+                    advance();
+                    continue;
+                }
+                expanded.push_back({top, depth});
+            }
+            stack.pop_back();
+            if (p == NO_PRODUCTION) {
+                cout << "Line " << lineNum << ": Error: No production for [" << SYMBOL_NAMES[top] << ", "
+                     << text << "]\n";
+                errorCount++;
+            } else {
+                for (int i = PRODUCTION_START[p + 1]; i > PRODUCTION_START[p]; i--) {
+                    stack.push_back(PRODUCTION_SYMBOLS[i - 1]);
+                }
+            }
+        }
+    }
+    return errorCount;
 }
 
-// For epsilon, put it in table for FOLLOW symbols
-if (production.size() == 1 && production[0] == "e") {
-   table[nonTerminal][c] = {"e"};
-} else {
-   table[nonTerminal][c] = production;
+int main() {
+    ios::sync_with_stdio(false);
+    string line;
+    vector<int> stack;
+    stack.reserve(64);
+    int lineNum = 1;
+    long long totalErrors = 0;
+    while (getline(cin, line)) {
+        if (!line.empty()) {
+            int errors = parseLine(line, lineNum, stack);
+            if (errors == 0) {
+                cout << "Line " << lineNum << ": Accept\n";
+            }
+            totalErrors += errors;
+        }
+        lineNum++;
+    }
+    cout << "Total errors: " << totalErrors << "\n";
+    return totalErrors == 0 ? 0 : 1;
 }
+)";
+    fout.close();
 }
+
+// Node of parse tree. Children of a node are next to each other in the arena, so
+// node only keep where they start and how many
+struct TreeNode {
+    int symbol;
+    int firstChild; // -1 if non-terminal was never expanded (error)
+    int childCount; // 0 with firstChild set mean epsilon
+    uint32_t tokenStart, tokenLength; // Where matched terminal is in the line
+};
+
+// Parse tree of one line. Nodes come from one vector used like bump arena, and
+// clear() free the whole tree at one time but keep the memory for next line
+struct ParseTree {
+    vector<TreeNode> nodes; // nodes[0] is root
+
+    void clear() { nodes.clear(); }
+
+    int allocate(int symbol) { // One new node
+        nodes.push_back({symbol, -1, 0, 0, 0});
+        return (int)nodes.size() - 1;
+    }
+
+    int allocateChildren(int parent, const int* begin, const int* end) { // Children in a row
+        int first = (int)nodes.size();
+        for (const int* it = begin; it != end; ++it) allocate(*it);
+        nodes[parent].firstChild = first;
+        nodes[parent].childCount = (int)(end - begin);
+        return first;
+    }
+};
+
+// Print tree with two spaces indent per level, matched terminals show input text
+void printTree(const ParseTree& tree, const SymbolTable& symbols, string_view line, TraceOutput& out) {
+    out.put("Parse tree:\n");
+    vector<pair<int, int>> pending = {{0, 0}}; // Node and depth, no recursion for deep trees
+    while (!pending.empty()) {
+        auto [node, depth] = pending.back();
+        pending.pop_back();
+        const TreeNode& n = tree.nodes[node];
+        out.pad(2 * depth + 2);
+        if (!symbols.isNonTerminal(n.symbol)) {
+            if (n.tokenLength > 0) {
+                out.put(line.substr(n.tokenStart, n.tokenLength));
+                out.put('\n');
+            } else {
+                out.put(symbols.name(n.symbol));
+                out.put(" (missing)\n");
+            }
+            continue;
+        }
+        out.put(symbols.name(n.symbol));
+        if (n.firstChild == -1) out.put(" (error)");
+        out.put('\n');
+        if (n.firstChild != -1 && n.childCount == 0) {
+            out.pad(2 * depth + 4);
+            out.put("e\n");
+        }
+        for (int i = n.childCount - 1; i >= 0; i--) pending.push_back({n.firstChild + i, depth + 1});
+    }
 }
+
+// Allocation counter for --stats. When off, operator new only check one flag before malloc.
+// Flag is set before any worker thread start
+bool countAllocations = false;
+atomic<uint64_t> allocationCount(0), allocationBytes(0);
+
+// Only a3 itself replace operator new; programs which include this file (bench) keep
+// the normal allocator, so their timing is not changed by the counter
+#ifndef A3_NO_MAIN
+void* operator new(size_t size) {
+    if (countAllocations) {
+        allocationCount.fetch_add(1, memory_order_relaxed);
+        allocationBytes.fetch_add(size, memory_order_relaxed);
+    }
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
 }
+// stable_sort and others take buffers with nothrow new, count them too and keep
+// them on same malloc as our delete
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    if (countAllocations) {
+        allocationCount.fetch_add(1, memory_order_relaxed);
+        allocationBytes.fetch_add(size, memory_order_relaxed);
+    }
+    return malloc(size ? size : 1);
 }
+// Kept out of line, else gcc see free() on memory from operator new and warn
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+// What parse loop did for one line
+struct ParseCounters {
+    uint64_t expansions = 0;
+    uint64_t matches = 0;
+    uint64_t recoveries = 0; // Errors where we skip input or pop stack and go on
+    uint32_t maxStackDepth = 0;
+};
 
-// Show the parsing table
-cout << "\nLL(1) Parsing Table:" << endl;
-cout << setw(15) << " ";
-for (const string& terminal : terminals) {
-cout << setw(15) << terminal;
+// Header of one line trace, same for LL(1) and LALR(1) driver
+void writeTraceHeader(TraceOutput& out, const string& input) {
+    out.put("\nParsing input: ");
+    out.put(input);
+    out.put('\n');
+    out.put(string_view(TRACE_RULE, 50));
+    out.put('\n');
+    out.putRight("Stack", 20);
+    out.putRight("Input", 20);
+    out.putRight("Action", 20);
+    out.put('\n');
+    out.put(string_view(TRACE_RULE, 50));
+    out.put('\n');
 }
-cout << endl;
 
-for (const auto& row : table) {
-cout << setw(15) << row.first;
-for (const string& terminal : terminals) {
-string entry;
-if (row.second.find(terminal) != row.second.end()) {
-entry = row.first + "->";
-for (size_t i = 0; i < row.second.at(terminal).size(); ++i) {
-entry += row.second.at(terminal)[i];
-if (i < row.second.at(terminal).size() - 1) entry += " ";
-}
+// Last lines of one line trace, summary mode give only the result
+void writeTraceResult(TraceOutput& out, int errorCount) {
+    if (out.full()) {
+        out.put(string_view(TRACE_RULE, 50));
+        out.put('\n');
+    }
+    if (!out.text()) return;
+    if (errorCount > 0) {
+        out.put("Parsing done but ");
+        out.putNumber(errorCount);
+        out.put(" error(s) happen.\n");
+    } else {
+        out.put("Parsing done, no error!\n");
+    }
 }
-cout << setw(15) << entry;
+
+// Action column of full trace row
+void writeTraceAction(TraceOutput& out, string_view action) {
+    out.putRight(action, 20);
+    out.put('\n');
 }
-cout << endl;
+
+// One parse error for callers who want them as data. Offset is where the token start
+// in line, or line length for end of input
+struct ParseError {
+    uint32_t offset;
+    string message;
+};
+
+// Push parser on LL(1) table: tokens are given one by one with feed() as they come and
+// finish() give the end marker. Each feed only do the steps for that token (expands
+// until it is matched or skipped), so many sessions can be kept open on one thread
+class ParseSession {
+private:
+    const ParseTable& table;
+    const SymbolTable& symbols;
+    TraceOutput* out; // Null or mode none mean no trace
+    bool full = false, binary = false;
+    ParseTree* tree;
+    vector<ParseError>* errors;
+    const TokenCursor* restOfInput = nullptr; // For trace input column, when whole line is known
+    ParsingStack stack;
+    ParseCounters count;
+    int errorCount = 0;
+    bool finished = false;
+    // Non-terminals expanded for current lookahead, with stack size when each was on
+    // top. Dropped when stack go below that size (it went to epsilon)
+    vector<pair<int, uint32_t>> expanded;
+
+    // Input column of trace row for token, at end marker it is only "$ "
+    void writeInput(const Token& token, bool atEnd) {
+        if (atEnd) {
+            out->putRight("$ ", 20);
+        } else if (restOfInput) {
+            restOfInput->writeRest(*out, 20);
+        } else { // Streaming, rest is not known yet
+            if ((int)token.text.size() + 5 < 20) out->pad(20 - token.text.size() - 5);
+            out->put(token.text);
+            out->put(" ... ");
+        }
+    }
+
+    void error(uint32_t offset, TraceStep kind, int32_t value, const string& message) {
+        if (full) writeTraceAction(*out, "Error: " + message);
+        if (binary) out->step(kind, value);
+        if (errors) errors->push_back({offset, message});
+        errorCount++;
+        count.recoveries++;
+    }
+
+    // Do steps with this lookahead until it is matched or skipped, or parse is over
+    void consume(const Token& token, uint32_t offset, bool atEnd) {
+        expanded.clear();
+        while (!stack.empty()) {
+            // Show current stack and input
+            if (full) {
+                stack.write(*out, 20);
+                writeInput(token, atEnd);
+            }
+
+            int topId = stack.top();
+            const string& topStack = symbols.name(topId);
+
+            // Both stack and input at $, success
+            if (topId == table.endMarker && token.id == table.endMarker) {
+                if (full) writeTraceAction(*out, "Accept");
+                if (binary) out->step(STEP_ACCEPT, 0);
+                finished = true;
+                return;
+            }
+
+            // Stack top is terminal, match with input
+            if (!symbols.isNonTerminal(topId)) {
+                if (topId == token.id) {
+                    if (full) writeTraceAction(*out, "Match: " + topStack);
+                    if (binary) out->step(STEP_MATCH, (int32_t)offset);
+                    if (tree && stack.topNode() != -1) {
+                        TreeNode& node = tree->nodes[stack.topNode()];
+                        node.tokenStart = offset;
+                        node.tokenLength = (uint32_t)token.text.size();
+                    }
+                    stack.pop();
+                    count.matches++;
+                } else {
+                    // Try fix by skip input symbol
+                    error(offset, STEP_SKIP, (int32_t)offset, "Expected " + topStack + " but found " + string(token.text));
+                }
+                return;
+            }
+
+            // Stack top is non-terminal, expand
+            int p = (token.id != -1 && !symbols.isNonTerminal(token.id))
+                        ? table.lookup(topId, token.id) : NO_PRODUCTION;
+            if (p != NO_PRODUCTION) {
+                // Same non-terminal again on top, and stack never went below its first place:
+                // with same lookahead it will repeat forever (only table with conflict can do
+                // this). Drop what it made and skip the token
+                uint32_t depth = (uint32_t)stack.size();
+                while (!expanded.empty() && expanded.back().second > depth) expanded.pop_back();
+                for (const auto& [nonTerminal, place] : expanded) {
+                    if (nonTerminal != topId) continue;
+                    while (stack.size() >= place) stack.pop();
+                    error(offset, STEP_SKIP, (int32_t)offset,
+                          "Endless expansion of " + topStack + " on " + string(token.text));
+                    return;
+                }
+                expanded.push_back({topId, depth});
+
+                int parent = stack.topNode();
+                stack.pop();
+
+                if (full) {
+                    string action = "Expand: " + topStack + " -> ";
+                    if (table.productionBegin(p) == table.productionEnd(p)) {
+                        action += "e ";
+                    }
+                    for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+                        action += symbols.name(*it) + " ";
+                    }
+                    writeTraceAction(*out, action);
+                }
+                if (binary) out->step(STEP_EXPAND, p);
+
+                // Push production in reverse, so pop correct later. If epsilon, just pop
+                int firstChild = tree ? tree->allocateChildren(parent, table.productionBegin(p), table.productionEnd(p)) : -1;
+                for (const int* it = table.productionEnd(p); it != table.productionBegin(p); ) {
+                    --it;
+                    stack.push(*it, tree ? firstChild + (int)(it - table.productionBegin(p)) : -1);
+                }
+                count.expansions++;
+                count.maxStackDepth = max(count.maxStackDepth, (uint32_t)stack.size());
+            } else {
+                // Try fix by pop from stack
+                error(offset, STEP_POP, topId, "No production for [" + topStack + ", " + string(token.text) + "]");
+                stack.pop();
+            }
+        }
+    }
+
+public:
+    ParseSession(const ParseTable& table, TraceOutput* out = nullptr, ParseTree* tree = nullptr,
+                 vector<ParseError>* errors = nullptr)
+        : table(table), symbols(table.symbols), out(out), tree(tree), errors(errors),
+          stack(out && out->full() ? &table.symbols : nullptr) { // Stack text only needed for full trace
+        full = out && out->full();
+        binary = out && out->binary();
+        stack.push(table.endMarker);  // Put end marker
+        if (tree) {
+            tree->clear();
+            stack.push(table.startSymbol, tree->allocate(table.startSymbol));  // Put start symbol
+        } else {
+            stack.push(table.startSymbol);  // Put start symbol
+        }
+        count.maxStackDepth = (uint32_t)stack.size();
+    }
+
+    // Trace show rest of input from this cursor, it must stand at the fed token
+    void traceInput(const TokenCursor* cursor) { restOfInput = cursor; }
+
+    // Give next token, false when parse is already over (accepted early)
+    bool feed(const Token& token, uint32_t offset) {
+        if (!finished) consume(token, offset, false);
+        return !finished;
+    }
+    bool feed(string_view text, uint32_t offset) { return feed(Token{symbols.find(text), text}, offset); }
+
+    // No more tokens. Give end marker and return error count
+    int finish(uint32_t endOffset) {
+        if (!finished) consume(Token{table.endMarker, "$"}, endOffset, true);
+        if (!finished) { // End marker was skipped, stack still have symbols
+            if (full) {
+                stack.write(*out, 20);
+                out->pad(20);
+                writeTraceAction(*out, "Error: Unexpected end of input");
+            }
+            if (binary) out->step(STEP_END_OF_INPUT, 0);
+            if (errors) errors->push_back({endOffset, "Unexpected end of input"});
+            errorCount++;
+            finished = true;
+        }
+        return errorCount;
+    }
+
+    bool done() const { return finished; }
+    int errorTotal() const { return errorCount; }
+    const ParseCounters& counters() const { return count; }
+};
+
+// Parse one line input, write trace to out and give back number of errors. If tree
+// is given, parse tree is built in it
+int parseInput(const ParseTable& table, const string& input, TraceOutput& out, ParseTree* tree = nullptr,
+               ParseCounters* counters = nullptr, vector<ParseError>* errors = nullptr) {
+    if (out.full()) writeTraceHeader(out, input);
+
+    TokenCursor cursor(table.symbols, input, table.endMarker);
+    ParseSession session(table, &out, tree, errors);
+    session.traceInput(&cursor);
+    while (!cursor.atEndMarker() && session.feed(cursor.peek(), (uint32_t)cursor.offset())) {
+        cursor.advance();
+    }
+    int errorCount = session.finish((uint32_t)input.size());
+    if (counters) *counters = session.counters();
+
+    writeTraceResult(out, errorCount);
+    return errorCount;
 }
 
-return table;
+// LALR(1) table. It is made from grammar as written, so left recursion is fine and no
+// factoring or epsilon tails are needed. Action of state x terminal is in one flat array:
+// 0 is error, s + 1 is shift to state s, -(p + 1) is reduce by production p. Reduce by
+// added start production S' -> S is accept
+const int LALR_ERROR = 0;
+
+struct LalrTable {
+    SymbolTable symbols;
+    int endMarker = -1;
+    int acceptProduction = -1; // The S' -> S production
+    vector<int> productionLhs, productionStart, pool; // Same layout as ParseTable
+    int stateCount = 0;
+    vector<int> action; // stateCount x terminalCount
+    vector<int> gotoState; // stateCount x non-terminal count, -1 if none
+    int conflicts = 0;
+
+    int productionCount() const { return (int)productionLhs.size(); }
+    const int* productionBegin(int p) const { return pool.data() + productionStart[p]; }
+    const int* productionEnd(int p) const { return pool.data() + productionStart[p + 1]; }
+
+    int actionAt(int state, int terminal) const {
+        return action[(size_t)state * symbols.terminalCount + terminal];
+    }
+    int gotoAt(int state, int nonTerminal) const {
+        return gotoState[(size_t)state * symbols.nonTerminalCount() + nonTerminal - symbols.terminalCount];
+    }
+};
+
+// Make production into string like A->B c
+string productionToString(const LalrTable& table, int p) {
+    string result = table.symbols.name(table.productionLhs[p]) + "->";
+    if (table.productionBegin(p) == table.productionEnd(p)) {
+        return result + "e"; // Epsilon production
+    }
+    for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+        if (it != table.productionBegin(p)) result += " ";
+        result += table.symbols.name(*it);
+    }
+    return result;
 }
 
-// Parse one line input
-void parseInput(const ParseTable& table, const Grammar& grammar, const string& input) {
-cout << "\nParsing input: " << input << endl;
-cout << string(50, '-') << endl;
-cout << setw(20) << "Stack" << setw(20) << "Input" << setw(20) << "Action" << endl;
-cout << string(50, '-') << endl;
+// Make LALR(1) table. First LR(0) states are made from kernel items, then lookaheads
+// are found like in dragon book: closure of each kernel item with dummy lookahead #
+// show which lookaheads are made in goto state and which flow there from the kernel
+// item, then flow is repeated until nothing change. Conflicts are warned and solved
+// like yacc: shift before reduce, earlier production before later
+LalrTable constructLALRTable(Grammar augmented) {
+    cout << "\nConstructing LALR(1) Parsing Table..." << endl;
+
+    // Add S' -> S, so accept is just reduce by it. Grammar is taken by value, caller
+    // move it in when it is not needed after
+    string startName = augmented.startSymbol + "'";
+    while (augmented.productions.count(startName)) startName += "'";
+    augmented.productions[startName] = {{augmented.startSymbol}};
+    augmented.startSymbol = startName;
+
+    LalrTable table;
+    table.symbols = buildSymbolTable(augmented);
+    const SymbolTable& symbols = table.symbols;
+    const int terminalCount = symbols.terminalCount;
+    const int nonTerminalCount = symbols.nonTerminalCount();
+    const int symbolCount = (int)symbols.names.size();
+    table.endMarker = symbols.find("$");
+
+    IdGrammar g = toIdGrammar(augmented, symbols);
+    GrammarSets sets = computeFirstSets(augmented, symbols);
+    const int productionCount = g.productionCount();
+
+    // Item is production with dot place, number is itemBase[p] + dot
+    vector<int> itemBase(productionCount), itemProduction;
+    vector<vector<int>> productionsOf(nonTerminalCount);
+    for (int p = 0; p < productionCount; p++) {
+        itemBase[p] = (int)itemProduction.size();
+        for (int dot = g.start[p]; dot <= g.start[p + 1]; dot++) itemProduction.push_back(p);
+        productionsOf[g.lhs[p] - terminalCount].push_back(p);
+        if (g.lhs[p] == symbols.find(startName)) table.acceptProduction = p;
+    }
+    auto dotPlace = [&](int item) { return g.start[itemProduction[item]] + item - itemBase[itemProduction[item]]; };
+    auto afterDot = [&](int item) { // Symbol after dot, -1 if dot at end
+        int at = dotPlace(item);
+        return at < g.start[itemProduction[item] + 1] ? g.symbols[at] : -1;
+    };
+
+    // LR(0) states, each is sorted kernel items. Goto of all symbols kept in one array
+    vector<vector<int>> kernels;
+    map<vector<int>, int> stateOf;
+    vector<int> transitions; // state x symbol, -1 if none
+    auto addState = [&](vector<int>& kernel) {
+        auto found = stateOf.find(kernel);
+        if (found != stateOf.end()) return found->second;
+        int state = (int)kernels.size();
+        stateOf.emplace(kernel, state);
+        kernels.push_back(kernel);
+        transitions.resize(transitions.size() + symbolCount, -1);
+        return state;
+    };
+    vector<int> start = {itemBase[table.acceptProduction]};
+    addState(start);
+
+    vector<int> closureStamp(nonTerminalCount, -1);
+    map<int, vector<int>> next; // Symbol -> kernel of goto state
+    for (int state = 0; state < (int)kernels.size(); state++) {
+        // LR(0) closure: add B -> .γ for every B after dot
+        vector<int> items = kernels[state];
+        for (size_t i = 0; i < items.size(); i++) {
+            int symbol = afterDot(items[i]);
+            if (symbol == -1 || !symbols.isNonTerminal(symbol)) continue;
+            if (closureStamp[symbol - terminalCount] == state) continue;
+            closureStamp[symbol - terminalCount] = state;
+            for (int q : productionsOf[symbol - terminalCount]) items.push_back(itemBase[q]);
+        }
+
+        next.clear();
+        for (int item : items) {
+            int symbol = afterDot(item);
+            if (symbol != -1) next[symbol].push_back(item + 1);
+        }
+        for (auto& [symbol, kernel] : next) {
+            sort(kernel.begin(), kernel.end());
+            kernel.erase(unique(kernel.begin(), kernel.end()), kernel.end());
+            int target = addState(kernel);
+            transitions[(size_t)state * symbolCount + symbol] = target;
+        }
+    }
+    const int stateCount = (int)kernels.size();
+    table.stateCount = stateCount;
+
+    // Kernel items of all states in one list, lookahead of each is found below
+    vector<int> kernelOffset(stateCount + 1, 0);
+    for (int s = 0; s < stateCount; s++) kernelOffset[s + 1] = kernelOffset[s] + (int)kernels[s].size();
+    vector<TerminalSet> lookahead(kernelOffset[stateCount], TerminalSet(terminalCount));
+    vector<vector<int>> propagate(kernelOffset[stateCount]); // Kernel item -> kernel items it flow to
+    auto kernelIndex = [&](int state, int item) {
+        const vector<int>& kernel = kernels[state];
+        return kernelOffset[state] + (int)(lower_bound(kernel.begin(), kernel.end(), item) - kernel.begin());
+    };
+
+    // LR(1) closure of seed items. Each item have lookahead set and flag for dummy #.
+    // Non-kernel items all have dot at start, so they are found by production
+    struct ClosureItem {
+        int item;
+        TerminalSet lookahead;
+        bool dummy; // Lookahead # is in set
+    };
+    vector<ClosureItem> closure;
+    vector<int> entryOf(productionCount, -1); // Production -> closure entry of its dot-start item
+    vector<int> work;
+    TerminalSet rest(terminalCount);
+    auto closeItems = [&]() {
+        work.clear();
+        for (int e = 0; e < (int)closure.size(); e++) work.push_back(e);
+        while (!work.empty()) {
+            int e = work.back();
+            work.pop_back();
+            int item = closure[e].item;
+            int symbol = afterDot(item);
+            if (symbol == -1 || !symbols.isNonTerminal(symbol)) continue;
+
+            // Lookahead of new items is FIRST of what is after symbol, and our own if that is nullable
+            rest.clear();
+            bool nullable = true;
+            int p = itemProduction[item];
+            for (int at = dotPlace(item) + 1; at < g.start[p + 1] && nullable; at++) {
+                int after = g.symbols[at];
+                if (!symbols.isNonTerminal(after)) {
+                    rest.insert(after);
+                    nullable = false;
+                } else {
+                    rest.unionWith(sets.first[after - terminalCount]);
+                    nullable = sets.nullable[after - terminalCount];
+                }
+            }
+            if (nullable) rest.unionWith(closure[e].lookahead);
+            bool dummy = nullable && closure[e].dummy;
+
+            for (int q : productionsOf[symbol - terminalCount]) {
+                int& entry = entryOf[q];
+                if (entry == -1) {
+                    entry = (int)closure.size();
+                    closure.push_back({itemBase[q], TerminalSet(terminalCount), false});
+                }
+                bool changed = closure[entry].lookahead.unionWith(rest);
+                if (dummy && !closure[entry].dummy) {
+                    closure[entry].dummy = true;
+                    changed = true;
+                }
+                if (changed) work.push_back(entry);
+            }
+        }
+    };
+    auto clearClosure = [&]() {
+        for (const ClosureItem& c : closure) {
+            if (dotPlace(c.item) == g.start[itemProduction[c.item]]) entryOf[itemProduction[c.item]] = -1;
+        }
+        closure.clear();
+    };
+
+    // Find which lookaheads are made spontaneously and which are propagated
+    lookahead[0].insert(table.endMarker);
+    for (int s = 0; s < stateCount; s++) {
+        for (int k = 0; k < (int)kernels[s].size(); k++) {
+            clearClosure();
+            closure.push_back({kernels[s][k], TerminalSet(terminalCount), true});
+            closeItems();
+            for (const ClosureItem& c : closure) {
+                int symbol = afterDot(c.item);
+                if (symbol == -1) continue;
+                int target = kernelIndex(transitions[(size_t)s * symbolCount + symbol], c.item + 1);
+                lookahead[target].unionWith(c.lookahead);
+                if (c.dummy) propagate[kernelOffset[s] + k].push_back(target);
+            }
+        }
+    }
+
+    // Flow lookaheads along propagate edges until nothing change
+    work.clear();
+    for (int i = 0; i < kernelOffset[stateCount]; i++) work.push_back(i);
+    while (!work.empty()) {
+        int from = work.back();
+        work.pop_back();
+        for (int to : propagate[from]) {
+            if (lookahead[to].unionWith(lookahead[from])) work.push_back(to);
+        }
+    }
 
-ParsingStack stack;
-stack.push("$");  // Put end marker
-stack.push(grammar.startSymbol);  // Put start symbol
+    // Fill action and goto tables. Productions copied, closure still need g
+    table.productionLhs = g.lhs;
+    table.productionStart = g.start;
+    table.pool = g.symbols;
+    table.action.assign((size_t)stateCount * terminalCount, LALR_ERROR);
+    table.gotoState.assign((size_t)stateCount * nonTerminalCount, -1);
+
+    for (int s = 0; s < stateCount; s++) {
+        for (int symbol = 0; symbol < symbolCount; symbol++) {
+            int target = transitions[(size_t)s * symbolCount + symbol];
+            if (target == -1) continue;
+            if (symbols.isNonTerminal(symbol)) {
+                table.gotoState[(size_t)s * nonTerminalCount + symbol - terminalCount] = target;
+            } else {
+                table.action[(size_t)s * terminalCount + symbol] = target + 1;
+            }
+        }
 
-istringstream iss(input);
-vector<string> inputSymbols;
-string symbol;
+        // Closure with real lookaheads, to find reduce items (also epsilon ones not in kernel)
+        clearClosure();
+        for (int k = 0; k < (int)kernels[s].size(); k++) {
+            closure.push_back({kernels[s][k], lookahead[kernelOffset[s] + k], false});
+        }
+        closeItems();
+        for (const ClosureItem& c : closure) {
+            if (afterDot(c.item) != -1) continue;
+            int p = itemProduction[c.item];
+            c.lookahead.forEach([&](int terminal) {
+                int& cell = table.action[(size_t)s * terminalCount + terminal];
+                int reduce = -(p + 1);
+                if (cell == LALR_ERROR || cell == reduce) {
+                    cell = reduce;
+                    return;
+                }
+                table.conflicts++;
+                if (cell > 0) {
+                    cout << "Warning: Shift/reduce conflict in state " << s << " on " << symbols.name(terminal)
+                         << ": shift " << cell - 1 << " or reduce " << productionToString(table, p) << endl;
+                } else {
+                    int other = -cell - 1;
+                    cout << "Warning: Reduce/reduce conflict in state " << s << " on " << symbols.name(terminal)
+                         << ": reduce " << productionToString(table, other) << " or reduce "
+                         << productionToString(table, p) << endl;
+                    if (p < other) cell = reduce;
+                }
+            });
+        }
+    }
 
-// Break input into symbols
-while (iss >> symbol) {
-inputSymbols.push_back(symbol);
+    cout << stateCount << " states, " << table.conflicts << " conflict(s)" << endl;
+    return table;
 }
-inputSymbols.push_back("$");  // Put end marker
 
-size_t inputPos = 0;
-int errorCount = 0;
+// Show productions with their numbers, then action and goto of every state
+void printLALRTable(const LalrTable& table) {
+    const SymbolTable& symbols = table.symbols;
+    const int terminalCount = symbols.terminalCount;
+    const int augmentedStart = table.productionLhs[table.acceptProduction];
+
+    cout.flush();
+    TraceOutput out(&cout);
+    out.put("\nLALR(1) Productions:\n");
+    for (int p = 0; p < table.productionCount(); p++) {
+        out.putRightNumber(p, 4);
+        out.put(": ");
+        out.put(productionToString(table, p));
+        out.put('\n');
+    }
 
-while (!stack.empty()) {
-// Show current stack and input
-string currentInput;
-for (size_t i = inputPos; i < inputSymbols.size(); i++) {
-currentInput += inputSymbols[i];
-currentInput += ' ';
+    out.put("\nLALR(1) Parsing Table:\n");
+    out.putRight("State", 6);
+    for (int terminal = 0; terminal < terminalCount; terminal++) out.putRight(symbols.name(terminal), 8);
+    for (int nonTerminal = terminalCount; nonTerminal < (int)symbols.names.size(); nonTerminal++) {
+        if (nonTerminal != augmentedStart) out.putRight(symbols.name(nonTerminal), 8);
+    }
+    out.put('\n');
+
+    string cell;
+    for (int s = 0; s < table.stateCount; s++) {
+        out.putRightNumber(s, 6);
+        for (int terminal = 0; terminal < terminalCount; terminal++) {
+            int action = table.actionAt(s, terminal);
+            cell.clear();
+            if (action > 0) cell = "s" + to_string(action - 1);
+            else if (action == -(table.acceptProduction + 1)) cell = "acc";
+            else if (action < 0) cell = "r" + to_string(-action - 1);
+            out.putRight(cell, 8);
+        }
+        for (int nonTerminal = terminalCount; nonTerminal < (int)symbols.names.size(); nonTerminal++) {
+            if (nonTerminal == augmentedStart) continue;
+            int target = table.gotoAt(s, nonTerminal);
+            if (target == -1) out.pad(8);
+            else out.putRightNumber(target, 8);
+        }
+        out.put('\n');
+    }
 }
 
-cout << setw(20) << stack.toString() << setw(20) << currentInput;
+// Shift-reduce driver for one line, trace look same as LL(1) one. On error the input
+// symbol is skipped. In counters shifts count as matches and reduces as expansions
+int parseInputLALR(const LalrTable& table, const string& input, TraceOutput& out,
+                   ParseCounters* counters = nullptr) {
+    const bool full = out.full(), binary = out.binary();
+    if (full) writeTraceHeader(out, input);
+
+    const SymbolTable& symbols = table.symbols;
+
+    ParsingStack stack(full ? &symbols : nullptr); // Symbols, only for trace
+    vector<int> states = {0};
+    states.reserve(64);
+    stack.push(table.endMarker);
+
+    TokenCursor cursor(symbols, input, table.endMarker);
+    int errorCount = 0;
+    ParseCounters count;
+    count.maxStackDepth = 1;
+
+    while (true) {
+        // Show current stack and input
+        if (full) {
+            stack.write(out, 20);
+            cursor.writeRest(out, 20);
+        }
 
-// If input finish but stack not empty
-if (inputPos >= inputSymbols.size()) {
-cout << setw(20) << "Error: Unexpected end of input" << endl;
-errorCount++;
-break;
+        const Token& token = cursor.peek();
+        int action = (token.id != -1 && !symbols.isNonTerminal(token.id))
+                         ? table.actionAt(states.back(), token.id) : LALR_ERROR;
+
+        if (action > 0) { // Shift
+            if (full) writeTraceAction(out, "Shift: " + string(token.text));
+            if (binary) out.step(STEP_SHIFT, (int32_t)cursor.offset());
+            stack.push(token.id);
+            states.push_back(action - 1);
+            cursor.advance();
+            count.matches++;
+        } else if (action < 0) {
+            int p = -action - 1;
+            if (p == table.acceptProduction) {
+                if (full) writeTraceAction(out, "Accept");
+                if (binary) out.step(STEP_ACCEPT, 0);
+                break;
+            }
+
+            // Reduce: pop right side, then go to state for left side
+            if (full) writeTraceAction(out, "Reduce: " + productionToString(table, p));
+            if (binary) out.step(STEP_REDUCE, p);
+            for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+                stack.pop();
+                states.pop_back();
+            }
+            int lhs = table.productionLhs[p];
+            stack.push(lhs);
+            states.push_back(table.gotoAt(states.back(), lhs));
+            count.expansions++;
+        } else if (token.id == table.endMarker) {
+            if (full) writeTraceAction(out, "Error: Unexpected end of input");
+            if (binary) out.step(STEP_END_OF_INPUT, 0);
+            errorCount++;
+            break;
+        } else {
+            if (full) writeTraceAction(out, "Error: Unexpected " + string(token.text));
+            if (binary) out.step(STEP_SKIP, (int32_t)cursor.offset());
+            errorCount++;
+
+            // Try fix by skip input symbol
+            cursor.advance();
+            count.recoveries++;
+        }
+        count.maxStackDepth = max(count.maxStackDepth, (uint32_t)states.size());
+    }
+    if (counters) *counters = count;
+
+    writeTraceResult(out, errorCount);
+    return errorCount;
 }
 
-string currentInputSymbol = inputSymbols[inputPos];
-string topStack = stack.top();
+// Read whitespace separated tokens from file descriptor through one fixed size block,
+// so memory stay same for any size of input. Token is a view into the block, only a
+// token cut by end of block is copied into carry. Line and column count from 1
+class TokenReader {
+private:
+    int fd;
+    vector<char> block;
+    size_t pos = 0, size = 0;
+    string carry;
+    uint32_t line = 1, column = 1; // Of next byte
+    uint32_t startLine = 0, startColumn = 0; // Of last token
+
+    bool refill() {
+        ssize_t got = read(fd, block.data(), block.size());
+        if (got <= 0) return false;
+        pos = 0;
+        size = (size_t)got;
+        return true;
+    }
+
+public:
+    enum Kind { TOKEN, NEWLINE, END };
+
+    explicit TokenReader(int fd, size_t blockSize = 1 << 16) : fd(fd), block(blockSize) {}
+
+    // Next token or newline. Text stay good until next call
+    Kind next(string_view& text) {
+        carry.clear();
+        bool inToken = false;
+        size_t start = 0;
+        while (true) {
+            if (pos == size) {
+                if (inToken) carry.append(block.data() + start, pos - start);
+                if (!refill()) { // End of file
+                    if (!inToken) return END;
+                    text = carry;
+                    return TOKEN;
+                }
+                start = 0;
+            }
+            char c = block[pos];
+            if (isspace((unsigned char)c)) {
+                if (inToken) { // Space stay for next call
+                    if (carry.empty()) {
+                        text = string_view(block.data() + start, pos - start);
+                    } else {
+                        carry.append(block.data() + start, pos - start);
+                        text = carry;
+                    }
+                    return TOKEN;
+                }
+                pos++;
+                if (c == '\n') {
+                    line++;
+                    column = 1;
+                    return NEWLINE;
+                }
+                column++;
+            } else {
+                if (!inToken) {
+                    inToken = true;
+                    start = pos;
+                    startLine = line;
+                    startColumn = column;
+                }
+                pos++;
+                column++;
+            }
+        }
+    }
 
-// Both stack and input at $, success
-if (topStack == "$" && currentInputSymbol == "$") {
-cout << setw(20) << "Accept" << endl;
-break;
+    uint32_t tokenLine() const { return startLine; }
+    uint32_t tokenColumn() const { return startColumn; }
+};
+
+// Parse token stream from file descriptor (stdin for --stream) with push sessions. Tokens
+// are fed as soon as they are read, newline end the sentence and its result is written
+// and flushed at once. Return total errors
+long long parseStream(const ParseTable& table, int fd) {
+    TraceOutput out(&cout, TraceMode::Summary);
+    TokenReader reader(fd);
+    vector<ParseError> errors;
+    optional<ParseSession> session; // Open sentence, made at its first token
+    uint32_t end = 0; // Offset after last token of line
+    int lineNum = 1;
+    long long totalErrors = 0;
+
+    auto endLine = [&]() {
+        if (session) {
+            int count = session->finish(end);
+            totalErrors += count;
+            out.put("Line ");
+            out.putNumber(lineNum);
+            if (count == 0) {
+                out.put(": accepted\n");
+            } else {
+                out.put(": ");
+                out.putNumber(count);
+                out.put(" error(s)\n");
+                for (const ParseError& error : errors) {
+                    out.put("  column ");
+                    out.putNumber(error.offset + 1);
+                    out.put(": ");
+                    out.put(error.message);
+                    out.put('\n');
+                }
+            }
+            out.flush(); // Answer now, other side may wait for it
+            session.reset();
+            errors.clear();
+        }
+        lineNum++;
+    };
+
+    string_view text;
+    TokenReader::Kind kind;
+    while ((kind = reader.next(text)) != TokenReader::END) {
+        if (kind == TokenReader::NEWLINE) {
+            endLine();
+            continue;
+        }
+        if (!session) session.emplace(table, nullptr, nullptr, &errors);
+        uint32_t offset = reader.tokenColumn() - 1;
+        session->feed(text, offset);
+        end = offset + (uint32_t)text.size();
+    }
+    endLine(); // Last line without newline
+
+    out.put("Total errors: ");
+    out.putNumber(totalErrors);
+    out.put('\n');
+    return totalErrors;
 }
 
-// Stack top is terminal, match with input
-if (!(topStack[0] >= 'A' && topStack[0] <= 'Z')) {
-if (topStack == currentInputSymbol) {
-cout << setw(20) << "Match: " + topStack << endl;
-stack.pop();
-inputPos++;
-} else {
-cout << setw(20) << "Error: Expected " + topStack + " but found " + currentInputSymbol << endl;
-errorCount++;
+// Parse whole file as one sentence, newlines are only spaces, so a program can go over
+// many lines. File is read through TokenReader and errors are written as they happen, so
+// memory do not grow with file size (only parse stack does, with nesting). Errors show
+// line and column of their token
+int parseWholeFile(const ParseTable& table, const string& filename, TraceMode mode, ParseCounters* counters) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error open input file: " << filename << endl;
+        exit(1);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    cout << "\nParsing whole file as one token stream: " << filename << endl;
+    TraceOutput out(&cout, mode);
+    TokenReader reader(fd);
+    vector<ParseError> errors;
+    ParseSession session(table, out.full() ? &out : nullptr, nullptr, &errors);
+    uint32_t line = 1, column = 1; // Place of token just fed, its errors are written with it
+    uint32_t endColumn = 1; // Just after last token, end of input error go there
+    uint64_t tokenCount = 0;
+
+    // Errors of last step all belong to the token just fed
+    auto writeErrors = [&]() {
+        if (out.text()) {
+            for (const ParseError& error : errors) {
+                out.put("Error at line ");
+                out.putNumber(line);
+                out.put(", column ");
+                out.putNumber(column);
+                out.put(": ");
+                out.put(error.message);
+                out.put('\n');
+            }
+        }
+        errors.clear();
+    };
+
+    string_view text;
+    TokenReader::Kind kind;
+    while (!session.done() && (kind = reader.next(text)) != TokenReader::END) {
+        if (kind == TokenReader::NEWLINE) continue;
+        line = reader.tokenLine();
+        column = reader.tokenColumn();
+        session.feed(text, column - 1);
+        tokenCount++;
+        if (!errors.empty()) writeErrors();
+        endColumn = column + (uint32_t)text.size();
+    }
+    column = endColumn;
+    int errorCount = session.finish(column - 1);
+    writeErrors();
+    close(fd);
+
+    if (counters) *counters = session.counters();
+    out.put("Tokens: ");
+    out.putNumber((long long)tokenCount);
+    out.put('\n');
+    if (errorCount > 0) {
+        out.put("Parsing done but ");
+        out.putNumber(errorCount);
+        out.put(" error(s) happen.\n");
+    } else {
+        out.put("Parsing done, no error!\n");
+    }
+    return errorCount;
+}
+
+// Result of one line kept in incremental parse cache
+struct CachedLine {
+    int errorCount;
+    vector<TreeNode> tree; // Empty if tree was not built
+};
 
-// Try fix by skip input symbol
-inputPos++;
+// Incremental parse cache: results keyed by hash of line content. Whole cache is only
+// good for the grammar it made with, so grammar hash is kept too
+struct ParseCache {
+    uint64_t grammarHash = 0;
+    unordered_map<uint64_t, CachedLine> lines;
+};
+
+const char PARSE_CACHE_MAGIC[4] = {'L', 'L', '1', 'P'};
+const uint32_t PARSE_CACHE_VERSION = 2; // 2: line results from table of trie left factoring
+
+// Check cached tree is a real tree: symbols are known, children come after their
+// parent and inside the tree, and no node is child two times. Then printTree can not
+// read out of range or go round forever
+bool validCachedTree(const vector<TreeNode>& tree, const SymbolTable& symbols) {
+    vector<bool> isChild(tree.size(), false);
+    for (size_t i = 0; i < tree.size(); i++) {
+        const TreeNode& n = tree[i];
+        if (n.symbol < 0 || n.symbol >= (int)symbols.names.size()) return false;
+        if (n.firstChild == -1) {
+            if (n.childCount != 0) return false;
+            continue;
+        }
+        if (n.firstChild <= (int64_t)i || n.childCount < 0 ||
+            (uint64_t)n.firstChild + (uint64_t)n.childCount > tree.size()) {
+            return false;
+        }
+        for (int c = n.firstChild; c < n.firstChild + n.childCount; c++) {
+            if (isChild[c]) return false;
+            isChild[c] = true;
+        }
+    }
+    return true;
 }
+
+// Matched terminals of cached tree must be inside the line they are printed from
+bool cachedTreeFitsLine(const vector<TreeNode>& tree, size_t lineSize) {
+    for (const TreeNode& n : tree) {
+        if ((uint64_t)n.tokenStart + n.tokenLength > lineSize) return false;
+    }
+    return true;
 }
-// Stack top is non-terminal, expand
-else {
-if (table.find(topStack) != table.end() &&
-table.at(topStack).find(currentInputSymbol) != table.at(topStack).end()) {
 
-vector<string> production = table.at(topStack).at(currentInputSymbol);
-stack.pop();
+// Read parse cache. Missing file, other version or other grammar give empty cache.
+// Broken file give empty cache too: every count is checked against bytes left in
+// file before anything is allocated, and every tree is checked before it is kept
+ParseCache loadParseCache(const string& filename, uint64_t grammarHash, const SymbolTable& symbols) {
+    ParseCache cache;
+    cache.grammarHash = grammarHash;
+    ifstream fin(filename, ios::binary | ios::ate);
+    if (!fin) return cache;
+    uint64_t fileSize = (uint64_t)fin.tellg();
+    fin.seekg(0);
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t hash = 0, count = 0;
+    fin.read(magic, 4);
+    fin.read((char*)&version, sizeof(version));
+    fin.read((char*)&hash, sizeof(hash));
+    fin.read((char*)&count, sizeof(count));
+    const uint64_t lineHeader = sizeof(uint64_t) + sizeof(int32_t) + sizeof(uint32_t);
+    uint64_t left = fin ? fileSize - (uint64_t)fin.tellg() : 0;
+    if (!fin || memcmp(magic, PARSE_CACHE_MAGIC, 4) != 0 || version != PARSE_CACHE_VERSION ||
+        hash != grammarHash || count > left / lineHeader) {
+        return cache;
+    }
 
-string action = "Expand: " + topStack + " -> ";
-for (const string& c : production) {
-action += c + " ";
+    cache.lines.reserve(count);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t lineHash;
+        int32_t errorCount;
+        uint32_t nodeCount;
+        fin.read((char*)&lineHash, sizeof(lineHash));
+        fin.read((char*)&errorCount, sizeof(errorCount));
+        fin.read((char*)&nodeCount, sizeof(nodeCount));
+        left -= lineHeader;
+        bool broken = !fin || errorCount < 0 || nodeCount > left / sizeof(TreeNode);
+        CachedLine line{errorCount, {}};
+        if (!broken) {
+            line.tree.resize(nodeCount);
+            fin.read((char*)line.tree.data(), nodeCount * sizeof(TreeNode));
+            left -= nodeCount * sizeof(TreeNode);
+            broken = !fin || !validCachedTree(line.tree, symbols);
+        }
+        if (broken) { // Broken file, better to start again
+            cache.lines.clear();
+            return cache;
+        }
+        cache.lines[lineHash] = move(line);
+    }
+    return cache;
 }
-cout << setw(20) << action << endl;
 
-// Push production in reverse, so pop correct later
-if (!(production.size() == 1 && production[0] == "e")) {
-for (auto it = production.rbegin(); it != production.rend(); ++it) {
-   stack.push(*it);
+// Write parse cache, through temp file so broken cache never seen
+void saveParseCache(const string& filename, const ParseCache& cache) {
+    string tempName = filename + ".tmp";
+    ofstream fout(tempName, ios::binary);
+    uint64_t count = cache.lines.size();
+    fout.write(PARSE_CACHE_MAGIC, 4);
+    fout.write((const char*)&PARSE_CACHE_VERSION, sizeof(PARSE_CACHE_VERSION));
+    fout.write((const char*)&cache.grammarHash, sizeof(cache.grammarHash));
+    fout.write((const char*)&count, sizeof(count));
+    for (const auto& entry : cache.lines) {
+        int32_t errorCount = entry.second.errorCount;
+        uint32_t nodeCount = (uint32_t)entry.second.tree.size();
+        fout.write((const char*)&entry.first, sizeof(entry.first));
+        fout.write((const char*)&errorCount, sizeof(errorCount));
+        fout.write((const char*)&nodeCount, sizeof(nodeCount));
+        fout.write((const char*)entry.second.tree.data(), nodeCount * sizeof(TreeNode));
+    }
+    fout.close();
+    if (!fout || rename(tempName.c_str(), filename.c_str()) != 0) {
+        cerr << "Warning: Can not write parse cache: " << filename << endl;
+        remove(tempName.c_str());
+    }
 }
+
+// Stats of one input line for --stats. Lines from parse cache have no counters
+struct LineStats {
+    int line = 0;
+    int errors = 0;
+    bool cached = false;
+    ParseCounters counters;
+};
+
+// Options for parsing input file
+struct ParseOptions {
+    int jobs = 1; // Worker threads, also used for grammar analysis
+    bool buildTree = false; // Build and print parse tree of every line
+    string parseCacheFile; // If set, only lines not in this cache are parsed again
+    uint64_t grammarHash = 0; // Grammar the parse cache belong to
+    vector<LineStats>* lineStats = nullptr; // If set, counters of every line go here in line order
+    const LalrTable* lalr = nullptr; // If set, lines are parsed with LALR(1) table instead
+    TraceMode trace = TraceMode::Full; // How much of parsing is written
+    string traceFile; // If set, trace go here and not to stdout (binary need it)
+};
+
+const char TRACE_MAGIC[4] = {'L', 'L', '1', 'T'};
+const uint32_t TRACE_VERSION = 1;
+
+// Start of binary trace: symbol names and productions, so steps can be read back.
+// Then every line is: line number, text length, text, steps, STEP_LINE_END step
+template <typename Table>
+void writeBinaryTraceHeader(TraceOutput& out, const Table& table) {
+    out.put(string_view(TRACE_MAGIC, 4));
+    out.putBinary<uint32_t>(TRACE_VERSION);
+    out.putBinary<uint32_t>((uint32_t)table.symbols.names.size());
+    out.putBinary<uint32_t>((uint32_t)table.symbols.terminalCount);
+    for (const string& name : table.symbols.names) {
+        out.putBinary<uint16_t>((uint16_t)name.size());
+        out.put(name);
+    }
+    out.putBinary<uint32_t>((uint32_t)table.productionCount());
+    for (int p = 0; p < table.productionCount(); p++) {
+        out.putBinary<int32_t>(table.productionLhs[p]);
+        out.putBinary<uint32_t>((uint32_t)(table.productionEnd(p) - table.productionBegin(p)));
+        for (const int* it = table.productionBegin(p); it != table.productionEnd(p); ++it) {
+            out.putBinary<int32_t>(*it);
+        }
+    }
 }
-// If epsilon, just pop
-} else {
-cout << setw(20) << "Error: No production for [" + topStack + ", " + currentInputSymbol + "]" << endl;
-errorCount++;
 
-// Try fix by pop from stack
-stack.pop();
+// Parse whole input file. When jobs more than 1, lines read in chunks and parsed on
+// worker threads which share the table (it is read only), then printed in line order.
+// With parse cache, lines seen before with same grammar give their old result
+void parseInputFile(const ParseTable& table, const string& filename, const ParseOptions& options) {
+    ifstream fin(filename);
+    if (!fin) {
+        cerr << "Error open input file: " << filename << endl;
+        exit(1);
+    }
+
+    string line;
+    int lineNum = 1;
+    long long totalErrors = 0;
+
+    const bool incremental = !options.parseCacheFile.empty();
+    ParseCache previous, next;
+    if (incremental) {
+        previous = loadParseCache(options.parseCacheFile, options.grammarHash, table.symbols);
+        next.grammarHash = options.grammarHash;
+    }
+    size_t reused = 0;
+
+    cout << "\nParsing input file: " << filename << endl;
+
+    // Trace go to stdout or own file, through one big buffer
+    ofstream traceFile;
+    if (!options.traceFile.empty()) {
+        traceFile.open(options.traceFile, ios::binary);
+        if (!traceFile) {
+            cerr << "Error open trace file: " << options.traceFile << endl;
+            exit(1);
+        }
+    }
+    TraceOutput trace(options.traceFile.empty() ? &cout : &traceFile, options.trace);
+    if (trace.binary()) {
+        if (options.lalr) writeBinaryTraceHeader(trace, *options.lalr);
+        else writeBinaryTraceHeader(trace, table);
+    }
+
+    // Parse one line or take it from cache. Fresh result go in result, for next cache
+    auto handleLine = [&](const string& text, int num, TraceOutput& out, ParseTree& tree,
+                          uint64_t& hash, CachedLine& result, bool& fromCache, ParseCounters* counters) {
+        if (out.text()) {
+            out.put("\nLine ");
+            out.putNumber(num);
+            out.put(": ");
+            out.put(text);
+            out.put('\n');
+        } else if (out.binary()) {
+            out.putBinary<uint32_t>(num);
+            out.putBinary<uint32_t>((uint32_t)text.size());
+            out.put(text);
+        }
+        fromCache = false;
+        if (incremental) {
+            hash = hashBytes(text);
+            auto it = previous.lines.find(hash);
+            if (it != previous.lines.end() && (!options.buildTree || !it->second.tree.empty()) &&
+                cachedTreeFitsLine(it->second.tree, text.size())) {
+                int errors = it->second.errorCount;
+                if (out.text()) {
+                    if (errors > 0) {
+                        out.put("(cached) Parsing done but ");
+                        out.putNumber(errors);
+                        out.put(" error(s) happen.\n");
+                    } else {
+                        out.put("(cached) Parsing done, no error!\n");
+                    }
+                }
+                if (out.binary()) out.step(STEP_LINE_END, errors);
+                if (options.buildTree) {
+                    tree.nodes = it->second.tree;
+                    if (out.text()) printTree(tree, table.symbols, text, out);
+                }
+                result.errorCount = errors;
+                result.tree = it->second.tree;
+                fromCache = true;
+                return errors;
+            }
+        }
+        int errors = options.lalr ? parseInputLALR(*options.lalr, text, out, counters)
+                                  : parseInput(table, text, out, options.buildTree ? &tree : nullptr, counters);
+        if (out.binary()) out.step(STEP_LINE_END, errors);
+        if (options.buildTree && out.text()) printTree(tree, table.symbols, text, out);
+        if (incremental) {
+            result.errorCount = errors;
+            result.tree = options.buildTree ? tree.nodes : vector<TreeNode>();
+        }
+        return errors;
+    };
+
+    const int jobs = options.jobs;
+    if (jobs <= 1) {
+        ParseTree tree;
+        uint64_t hash = 0;
+        CachedLine result;
+        bool fromCache = false;
+        ParseCounters counters;
+        while (getline(fin, line)) {
+            if (!line.empty()) {
+                counters = ParseCounters();
+                int errors = handleLine(line, lineNum, trace, tree, hash, result, fromCache,
+                                        options.lineStats ? &counters : nullptr);
+                totalErrors += errors;
+                if (options.lineStats) options.lineStats->push_back({lineNum, errors, fromCache, counters});
+                if (incremental) {
+                    reused += fromCache;
+                    next.lines[hash] = move(result);
+                }
+            }
+            lineNum++;
+        }
+    } else {
+        const size_t chunkSize = 4096 * (size_t)jobs; // Lines in memory at one time
+        vector<string> lines;
+        vector<int> lineNums;
+        vector<string> outputs(chunkSize);
+        vector<int> errors(chunkSize);
+        vector<uint64_t> hashes(chunkSize);
+        vector<CachedLine> results(chunkSize);
+        vector<char> fromCache(chunkSize);
+        vector<ParseCounters> counters(options.lineStats ? chunkSize : 0);
+        bool more = true;
+
+        while (more) {
+            // Read next chunk of non-empty lines
+            lines.clear();
+            lineNums.clear();
+            while (lines.size() < chunkSize && (more = (bool)getline(fin, line))) {
+                if (!line.empty()) {
+                    lines.push_back(line);
+                    lineNums.push_back(lineNum);
+                }
+                lineNum++;
+            }
+
+            // Workers take next line from shared counter until chunk finish
+            atomic<size_t> nextLine(0);
+            auto worker = [&]() {
+                TraceOutput out(nullptr, options.trace, 4096); // No sink, text of line is taken after
+                ParseTree tree; // Each worker reuse its own arena
+                for (size_t i; (i = nextLine.fetch_add(1)) < lines.size(); ) {
+                    bool cached = false;
+                    if (options.lineStats) counters[i] = ParseCounters();
+                    errors[i] = handleLine(lines[i], lineNums[i], out, tree, hashes[i], results[i], cached,
+                                           options.lineStats ? &counters[i] : nullptr);
+                    fromCache[i] = cached;
+                    outputs[i] = out.take();
+                }
+            };
+            vector<thread> workers;
+            int threadCount = (int)min<size_t>(jobs, lines.size());
+            for (int t = 0; t < threadCount; t++) workers.emplace_back(worker);
+            for (thread& t : workers) t.join();
+
+            // Print in the original order
+            for (size_t i = 0; i < lines.size(); i++) {
+                trace.put(outputs[i]);
+                totalErrors += errors[i];
+                if (options.lineStats) {
+                    options.lineStats->push_back({lineNums[i], errors[i], (bool)fromCache[i], counters[i]});
+                }
+                if (incremental) {
+                    reused += fromCache[i];
+                    next.lines[hashes[i]] = move(results[i]);
+                }
+            }
+        }
+    }
+    trace.flush();
+
+    cout << "\nParsing finished for all lines." << endl;
+    cout << "Total errors: " << totalErrors << endl;
+    if (incremental) {
+        cout << "Reused " << reused << " cached line result(s)." << endl;
+        saveParseCache(options.parseCacheFile, next);
+    }
+    fin.close();
 }
+
+// Wall time and allocations of one stage called from main
+struct StageStats {
+    string name;
+    double seconds;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+};
+
+// All stats of one run, filled only with --stats
+struct RunStats {
+    bool enabled = false;
+    vector<StageStats> stages;
+    vector<LineStats> lines;
+};
+
+// Run one stage and give its result. With stats off it is only the call
+template <class Fn>
+auto runStage(RunStats& stats, const char* name, Fn&& fn) -> decltype(fn()) {
+    if (!stats.enabled) return fn();
+
+    uint64_t allocationsBefore = allocationCount.load(), bytesBefore = allocationBytes.load();
+    auto start = chrono::steady_clock::now();
+    struct Record { // Record also when fn return, whatever type it give
+        RunStats& stats;
+        const char* name;
+        uint64_t allocationsBefore, bytesBefore;
+        chrono::steady_clock::time_point start;
+        ~Record() {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            stats.stages.push_back({name, seconds, allocationCount.load() - allocationsBefore,
+                                    allocationBytes.load() - bytesBefore});
+        }
+    } record{stats, name, allocationsBefore, bytesBefore, start};
+    return fn();
 }
+
+// Write stats as JSON or Prometheus text format
+void writeStats(const RunStats& stats, const string& format, ostream& out) {
+    ParseCounters total;
+    long long totalErrors = 0;
+    for (const LineStats& line : stats.lines) {
+        total.expansions += line.counters.expansions;
+        total.matches += line.counters.matches;
+        total.recoveries += line.counters.recoveries;
+        total.maxStackDepth = max(total.maxStackDepth, line.counters.maxStackDepth);
+        totalErrors += line.errors;
+    }
+
+    if (format == "prometheus") {
+        auto metric = [&](const char* name, const char* type, const char* help) {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+        };
+        metric("ll1_stage_seconds", "gauge", "Wall time of pipeline stage.");
+        for (const StageStats& stage : stats.stages) {
+            out << "ll1_stage_seconds{stage=\"" << stage.name << "\"} " << stage.seconds << "\n";
+        }
+        metric("ll1_stage_allocations", "gauge", "Heap allocations made in pipeline stage.");
+        for (const StageStats& stage : stats.stages) {
+            out << "ll1_stage_allocations{stage=\"" << stage.name << "\"} " << stage.allocations << "\n";
+        }
+        metric("ll1_stage_allocated_bytes", "gauge", "Heap bytes allocated in pipeline stage.");
+        for (const StageStats& stage : stats.stages) {
+            out << "ll1_stage_allocated_bytes{stage=\"" << stage.name << "\"} " << stage.allocatedBytes << "\n";
+        }
+
+        metric("ll1_parse_lines_total", "counter", "Input lines parsed or taken from cache.");
+        out << "ll1_parse_lines_total " << stats.lines.size() << "\n";
+        metric("ll1_parse_errors_total", "counter", "Parse errors over all lines.");
+        out << "ll1_parse_errors_total " << totalErrors << "\n";
+        metric("ll1_parse_expansions_total", "counter", "Non-terminal expansions over all lines.");
+        out << "ll1_parse_expansions_total " << total.expansions << "\n";
+        metric("ll1_parse_matches_total", "counter", "Terminal matches over all lines.");
+        out << "ll1_parse_matches_total " << total.matches << "\n";
+        metric("ll1_parse_recoveries_total", "counter", "Error recoveries over all lines.");
+        out << "ll1_parse_recoveries_total " << total.recoveries << "\n";
+        metric("ll1_parse_max_stack_depth", "gauge", "Deepest parse stack over all lines.");
+        out << "ll1_parse_max_stack_depth " << total.maxStackDepth << "\n";
+
+        // Per line series, labeled with line number
+        auto perLine = [&](const char* name, const char* help, auto value) {
+            metric(name, "gauge", help);
+            for (const LineStats& line : stats.lines) {
+                out << name << "{line=\"" << line.line << "\"} " << value(line) << "\n";
+            }
+        };
+        perLine("ll1_line_errors", "Parse errors of input line.", [](const LineStats& l) { return (uint64_t)l.errors; });
+        perLine("ll1_line_expansions", "Expansions of input line.", [](const LineStats& l) { return l.counters.expansions; });
+        perLine("ll1_line_matches", "Matches of input line.", [](const LineStats& l) { return l.counters.matches; });
+        perLine("ll1_line_recoveries", "Error recoveries of input line.", [](const LineStats& l) { return l.counters.recoveries; });
+        perLine("ll1_line_max_stack_depth", "Deepest parse stack of input line.",
+                [](const LineStats& l) { return (uint64_t)l.counters.maxStackDepth; });
+        return;
+    }
+
+    out << "{\"stages\":[";
+    for (size_t i = 0; i < stats.stages.size(); i++) {
+        const StageStats& stage = stats.stages[i];
+        out << (i ? "," : "") << "{\"name\":\"" << stage.name << "\",\"seconds\":" << stage.seconds
+            << ",\"allocations\":" << stage.allocations << ",\"allocated_bytes\":" << stage.allocatedBytes << "}";
+    }
+    out << "],\"parse\":{\"lines\":" << stats.lines.size() << ",\"errors\":" << totalErrors
+        << ",\"expansions\":" << total.expansions << ",\"matches\":" << total.matches
+        << ",\"recoveries\":" << total.recoveries << ",\"max_stack_depth\":" << total.maxStackDepth << "}";
+    out << ",\"lines\":[";
+    for (size_t i = 0; i < stats.lines.size(); i++) {
+        const LineStats& line = stats.lines[i];
+        out << (i ? "," : "") << "{\"line\":" << line.line << ",\"cached\":" << (line.cached ? "true" : "false")
+            << ",\"errors\":" << line.errors << ",\"expansions\":" << line.counters.expansions
+            << ",\"matches\":" << line.counters.matches << ",\"recoveries\":" << line.counters.recoveries
+            << ",\"max_stack_depth\":" << line.counters.maxStackDepth << "}";
+    }
+    out << "]}\n";
 }
 
-cout << string(50, '-') << endl;
-if (errorCount > 0) {
-cout << "Parsing done but " << errorCount << " error(s) happen." << endl;
-} else {
-cout << "Parsing done, no error!" << endl;
+// Whole LL(1) analysis of grammar file, printing every step, or take it from cache.
+// Sets and table are made on jobs threads, output is same for any jobs
+ParseTable analyzeGrammar(const string& grammarFile, uint64_t grammarHash, bool useCache, bool compress,
+                          bool simplify, int jobs, RunStats& stats) {
+    string cacheFile = grammarFile + ".ll1";
+    ParseTable parseTable;
+    if (useCache && runStage(stats, "load_cache", [&] { return loadAnalysisCache(cacheFile, grammarHash, parseTable); })) {
+        cout << "Loaded analyzed grammar from cache: " << cacheFile << endl;
+        if (compress) runStage(stats, "compress_table", [&] { compressTable(parseTable); });
+    } else {
+        // Read grammar from file. Only this one grammar is kept, every pass change it in
+        // place and printing show it right after the pass, so no copy is needed
+        Grammar finalGrammar = runStage(stats, "read_grammar", [&] { return readGrammar(grammarFile); });
+
+        // Do left factoring
+        runStage(stats, "left_factoring", [&] { applyLeftFactoring(finalGrammar); });
+        runStage(stats, "print_factored_grammar", [&] { printGrammar(finalGrammar, "Grammar After Left Factoring"); });
+
+        // Remove left recursion
+        runStage(stats, "left_recursion", [&] { removeLeftRecursion(finalGrammar); });
+        runStage(stats, "print_recursion_free_grammar", [&] { printGrammar(finalGrammar, "Grammar After Left Recursion Removal"); });
+
+        // Make grammar smaller, so parse need fewer expansions
+        if (simplify) {
+            runStage(stats, "simplify", [&] { simplifyGrammar(finalGrammar); });
+            runStage(stats, "print_simplified_grammar", [&] { printGrammar(finalGrammar, "Grammar After Simplification"); });
+        }
+
+        // Get FIRST sets
+        SymbolTable symbols = runStage(stats, "symbol_table", [&] { return buildSymbolTable(finalGrammar); });
+        GrammarSets sets = runStage(stats, "first_sets", [&] { return computeFirstSets(finalGrammar, symbols, jobs); });
+        runStage(stats, "print_first_sets", [&] { printSets(symbols, sets.first, &sets.nullable, "FIRST Sets"); });
+
+        // Get FOLLOW sets
+        sets.follow = runStage(stats, "follow_sets", [&] { return computeFollowSets(finalGrammar, symbols, sets, jobs); });
+        runStage(stats, "print_follow_sets", [&] { printSets(symbols, sets.follow, nullptr, "FOLLOW Sets"); });
+
+        // Make parsing table
+        parseTable = runStage(stats, "build_table", [&] { return constructLL1Table(finalGrammar, symbols, sets, jobs); });
+        runStage(stats, "print_table", [&] { printLL1Table(parseTable, sets); });
+        if (compress) {
+            size_t denseSize = parseTable.cells.size();
+            runStage(stats, "compress_table", [&] { compressTable(parseTable); });
+            cout << "\nCompressed table: " << denseSize << " cells packed into "
+                 << parseTable.packed.size() << endl;
+        }
+
+        if (useCache) {
+            runStage(stats, "save_cache", [&] { saveAnalysisCache(cacheFile, grammarHash, parseTable, sets); });
+        }
+    }
+    return parseTable;
 }
+
+// Parse server. Grammars are analyzed once at start and their tables stay in memory;
+// clients talk over Unix socket, every connection get own thread, so requests of many
+// clients run at same time (tables are read only). Numbers are little endian.
+//   Request:  u32 length, then u8 flags (1 = want tree), u8 grammar name length, name,
+//             and input sentence as rest of bytes
+//   Response: u32 length, then u8 status (0 accepted, 1 has errors, 2 bad request),
+//             u32 error count, each error as u32 offset, u16 length, message, then
+//             u32 tree length and tree text (empty if not asked)
+const uint32_t SERVER_MAX_REQUEST = 64 << 20;
+// Most connections served at same time. More clients wait in listen backlog
+const int SERVER_MAX_CONNECTIONS = 64;
+
+void putU16(string& out, uint16_t value) {
+    out += (char)(value & 0xff);
+    out += (char)(value >> 8);
 }
 
-// Parse whole input file
-void parseInputFile(const ParseTable& table, const Grammar& grammar, const string& filename) {
-ifstream fin(filename);
-if (!fin) {
-cerr << "Error open input file: " << filename << endl;
-exit(1);
+void putU32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out += (char)((value >> (8 * i)) & 0xff);
 }
 
-string line;
-int lineNum = 1;
-int totalErrors = 0;
+uint32_t getU32(const unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
 
-cout << "\nParsing input file: " << filename << endl;
+// Read or write all bytes, false if connection is closed or broken
+bool readFully(int fd, void* data, size_t size) {
+    char* at = (char*)data;
+    while (size > 0) {
+        ssize_t got = read(fd, at, size);
+        if (got <= 0) return false;
+        at += got;
+        size -= got;
+    }
+    return true;
+}
 
-while (getline(fin, line)) {
-if (!line.empty()) {
-cout << "\nLine " << lineNum << ": " << line << endl;
-parseInput(table, grammar, line);
+bool writeFully(int fd, const void* data, size_t size) {
+    const char* at = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = send(fd, at, size, MSG_NOSIGNAL); // No SIGPIPE if client went away
+        if (sent <= 0) return false;
+        at += sent;
+        size -= sent;
+    }
+    return true;
 }
-lineNum++;
+
+// Make answer for one request payload
+string answerRequest(const map<string, ParseTable, less<>>& tables, string_view request, ParseTree& tree) {
+    string response;
+    auto badRequest = [&](const string& message) {
+        response.clear();
+        response += (char)2;
+        putU32(response, 1);
+        putU32(response, 0);
+        putU16(response, (uint16_t)message.size());
+        response += message;
+        putU32(response, 0);
+        return response;
+    };
+
+    if (request.size() < 2 || request.size() < 2 + (size_t)(unsigned char)request[1]) return badRequest("Broken request");
+    bool wantTree = request[0] & 1;
+    string_view name = request.substr(2, (unsigned char)request[1]);
+    auto found = tables.find(name);
+    if (found == tables.end()) return badRequest("Unknown grammar: " + string(name));
+    const ParseTable& table = found->second;
+    string input(request.substr(2 + name.size()));
+
+    vector<ParseError> errors;
+    TraceOutput noTrace(nullptr, TraceMode::None, 0);
+    parseInput(table, input, noTrace, wantTree ? &tree : nullptr, nullptr, &errors);
+
+    response += (char)(errors.empty() ? 0 : 1);
+    putU32(response, (uint32_t)errors.size());
+    for (const ParseError& error : errors) {
+        putU32(response, error.offset);
+        putU16(response, (uint16_t)min<size_t>(error.message.size(), 0xffff));
+        response.append(error.message, 0, 0xffff);
+    }
+    if (wantTree) {
+        TraceOutput text(nullptr, TraceMode::Full, 256);
+        printTree(tree, table.symbols, input, text);
+        string treeText = text.take();
+        putU32(response, (uint32_t)treeText.size());
+        response += treeText;
+    } else {
+        putU32(response, 0);
+    }
+    return response;
 }
 
-cout << "\nParsing finished for all lines." << endl;
-fin.close();
+// Answer requests of one client until it close connection
+void serveConnection(int fd, const map<string, ParseTable, less<>>& tables) {
+    ParseTree tree; // Arena reused by all requests of this connection
+    string request;
+    unsigned char header[4];
+    while (readFully(fd, header, 4)) {
+        uint32_t length = getU32(header);
+        if (length > SERVER_MAX_REQUEST) break;
+        request.resize(length);
+        if (!readFully(fd, request.data(), length)) break;
+
+        string response = answerRequest(tables, request, tree);
+        string frame;
+        putU32(frame, (uint32_t)response.size());
+        frame += response;
+        if (!writeFully(fd, frame.data(), frame.size())) break;
+    }
+    close(fd);
 }
 
-int main() {
-// Read grammar from file
-string grammarFile = "grammar.txt";
-Grammar originalGrammar = readGrammar(grammarFile);
+// Count of connection threads, accept wait while it is full
+class ConnectionLimit {
+public:
+    explicit ConnectionLimit(int limit) : limit(limit) {}
 
-// Do left factoring
-Grammar factoredGrammar = applyLeftFactoring(originalGrammar);
-printGrammar(factoredGrammar, "Grammar After Left Factoring");
+    void acquire() {
+        unique_lock<mutex> lock(guard);
+        changed.wait(lock, [&] { return active < limit; });
+        active++;
+    }
 
-// Remove left recursion
-Grammar finalGrammar = removeLeftRecursion(factoredGrammar);
-printGrammar(finalGrammar, "Grammar After Left Recursion Removal");
+    void release() {
+        lock_guard<mutex> lock(guard);
+        active--;
+        changed.notify_all();
+    }
 
-// Get FIRST sets
-map<string, set<string>> firstSets = computeFirstSets(finalGrammar);
-printSets(firstSets, "FIRST Sets");
+    // Wait all threads finish, they use tables of caller
+    void drain() {
+        unique_lock<mutex> lock(guard);
+        changed.wait(lock, [&] { return active == 0; });
+    }
 
-// Get FOLLOW sets
-map<string, set<string>> followSets = computeFollowSets(finalGrammar, firstSets);
-printSets(followSets, "FOLLOW Sets");
+private:
+    mutex guard;
+    condition_variable changed;
+    int active = 0;
+    int limit;
+};
 
-// Make parsing table
-ParseTable parseTable = constructLL1Table(finalGrammar, firstSets, followSets);
+// Listen on socket path and serve until killed
+int runServer(const string& socketPath, const map<string, ParseTable, less<>>& tables) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Can not make socket: " << socketPath << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str()); // Old socket file of last run
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        cerr << "Error: Can not listen on " << socketPath << ": " << strerror(errno) << endl;
+        close(listener);
+        return 1;
+    }
+
+    cout << "Serving " << tables.size() << " grammar(s) on " << socketPath << endl;
+    ConnectionLimit connections(SERVER_MAX_CONNECTIONS);
+    while (true) {
+        connections.acquire();
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            connections.release();
+            if (errno == EINTR) continue;
+            cerr << "Error: accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        thread([&tables, &connections, client] {
+            serveConnection(client, tables);
+            connections.release();
+        }).detach();
+    }
+    close(listener);
+    connections.drain();
+    return 1;
+}
+
+// bench.cpp include this file for the pipeline, so it turn main off
+#ifndef A3_NO_MAIN
+const int MAX_JOBS = 1024; // More threads than this is surely a typo
+
+// Read thread count of --jobs, false if it is not a whole number 1..MAX_JOBS
+bool parseJobs(const char* text, int& jobs) {
+    string_view view(text);
+    int value = 0;
+    auto [end, error] = from_chars(view.data(), view.data() + view.size(), value);
+    if (error != errc() || end != view.data() + view.size() || value < 1 || value > MAX_JOBS) return false;
+    jobs = value;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // Read options
+    ParseOptions parseOptions; // Worker threads for parsing input, tree output
+    bool useCache = false; // Keep analyzed grammar in grammar file + ".ll1"
+    bool compress = false; // Use compressed table layout
+    bool useLALR = false; // Parse with LALR(1) table made from grammar as written
+    bool stream = false; // Parse token stream from stdin, one sentence per line
+    bool wholeFile = false; // Parse input file as one sentence, not line by line
+    bool simplify = false; // Run simplification passes before making table
+    string emitFile; // If set, write standalone parser here and stop
+    RunStats stats; // Stage times, allocations and parse counters
+    string socketPath; // If set, run as parse server on this Unix socket
+    vector<pair<string, string>> serverGrammars; // Name and file of grammars to serve
+    string statsFormat = "json", statsFile; // Stats go to stderr if no file
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "--jobs" || arg == "-j") && i + 1 < argc && parseJobs(argv[i + 1], parseOptions.jobs)) {
+            i++;
+        } else if (arg == "--tree") {
+            parseOptions.buildTree = true;
+        } else if (arg == "--incremental") {
+            parseOptions.parseCacheFile = "input.txt.parsecache";
+        } else if (arg == "--cache") {
+            useCache = true;
+        } else if (arg == "--compress-table") {
+            compress = true;
+        } else if (arg == "--lalr") {
+            useLALR = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--whole-file") {
+            wholeFile = true;
+        } else if (arg == "--simplify") {
+            simplify = true;
+        } else if (arg == "--emit-parser" && i + 1 < argc) {
+            emitFile = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc && (string(argv[i + 1]) == "json" || string(argv[i + 1]) == "prometheus")) {
+            stats.enabled = true;
+            statsFormat = argv[++i];
+        } else if (arg == "--stats") {
+            stats.enabled = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--grammar" && i + 1 < argc && strchr(argv[i + 1], '=')) {
+            string spec = argv[++i];
+            size_t equal = spec.find('=');
+            serverGrammars.push_back({spec.substr(0, equal), spec.substr(equal + 1)});
+        } else if (arg == "--trace" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "none") parseOptions.trace = TraceMode::None;
+            else if (mode == "summary") parseOptions.trace = TraceMode::Summary;
+            else if (mode == "full") parseOptions.trace = TraceMode::Full;
+            else if (mode == "binary") parseOptions.trace = TraceMode::Binary;
+            else {
+                cerr << "Error: Unknown trace mode: " << mode << endl;
+                return 1;
+            }
+        } else if (arg == "--trace-file" && i + 1 < argc) {
+            parseOptions.traceFile = argv[++i];
+        } else if (arg == "--stats-file" && i + 1 < argc) {
+            stats.enabled = true;
+            statsFile = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--serve SOCKET [--grammar NAME=FILE]...]"
+                 << " [--lalr] [--simplify] [--stream] [--whole-file] [--jobs N] [--cache] [--compress-table] [--tree] [--incremental]"
+                 << " [--emit-parser FILE] [--trace none|summary|full|binary] [--trace-file FILE]"
+                 << " [--stats [json|prometheus]] [--stats-file FILE]" << endl;
+            return 1;
+        }
+    }
+    if (parseOptions.trace == TraceMode::Binary && parseOptions.traceFile.empty()) {
+        cerr << "Error: --trace binary need --trace-file" << endl;
+        return 1;
+    }
+    if (useLALR && (useCache || compress || parseOptions.buildTree || !emitFile.empty() || stream || wholeFile)) {
+        cerr << "Error: --lalr can not be used with --cache, --compress-table, --tree, --emit-parser, --stream or --whole-file" << endl;
+        return 1;
+    }
+    if (wholeFile && (parseOptions.buildTree || !parseOptions.parseCacheFile.empty() ||
+                      parseOptions.trace == TraceMode::Binary)) {
+        cerr << "Error: --whole-file can not be used with --tree, --incremental or binary trace" << endl;
+        return 1;
+    }
+    if (stats.enabled) {
+        countAllocations = true;
+        parseOptions.lineStats = &stats.lines;
+    }
 
-// Parse input file
-string inputFile = "input.txt";
-parseInputFile(parseTable, finalGrammar, inputFile);
+    string grammarFile = "grammar.txt";
+
+    // Write stats to stderr or stats file, when asked
+    auto writeRunStats = [&] {
+        if (!stats.enabled) return;
+        countAllocations = false;
+        if (statsFile.empty()) {
+            writeStats(stats, statsFormat, cerr);
+        } else {
+            ofstream statsOut(statsFile);
+            writeStats(stats, statsFormat, statsOut);
+        }
+    };
+
+    // Server mode: analyze all grammars once (quietly, only warnings go to stderr), then answer requests
+    if (!socketPath.empty()) {
+        if (useLALR) {
+            cerr << "Error: --serve only support LL(1) tables" << endl;
+            return 1;
+        }
+        if (serverGrammars.empty()) serverGrammars.push_back({"default", grammarFile});
+        map<string, ParseTable, less<>> tables;
+        for (const auto& [name, file] : serverGrammars) {
+            uint64_t hash = useCache ? hashFile(file) : 0;
+            if (useCache && simplify) hash = hashBytes("simplify", hash);
+            cout.setstate(ios::badbit);
+            tables[name] = analyzeGrammar(file, hash, useCache, compress, simplify, parseOptions.jobs, stats);
+            cout.clear();
+            cout << "Loaded grammar " << name << " from " << file << endl;
+        }
+        writeRunStats(); // Server run until killed, so only analysis stages are written
+        return runServer(socketPath, tables);
+    }
+    bool needHash = useCache || !parseOptions.parseCacheFile.empty();
+    uint64_t grammarHash = needHash ? runStage(stats, "hash_grammar", [&] { return hashFile(grammarFile); }) : 0;
+    // Simplified grammar give other table, so cache of it must not mix with plain one
+    if (needHash && simplify) grammarHash = hashBytes("simplify", grammarHash);
+    ParseTable parseTable;
+    LalrTable lalrTable;
+
+    if (useLALR) {
+        // No transformation, LALR(1) take left recursion as it is
+        Grammar originalGrammar = runStage(stats, "read_grammar", [&] { return readGrammar(grammarFile); });
+        lalrTable = runStage(stats, "build_lalr_table", [&] { return constructLALRTable(move(originalGrammar)); });
+        runStage(stats, "print_lalr_table", [&] { printLALRTable(lalrTable); });
+        parseOptions.lalr = &lalrTable;
+        grammarHash = hashBytes("lalr", grammarHash); // Parse cache of LL(1) run is not good here
+    } else {
+        if (stream) cout.setstate(ios::badbit); // Stdout is only for stream answers
+        parseTable = analyzeGrammar(grammarFile, grammarHash, useCache, compress, simplify, parseOptions.jobs, stats);
+        cout.clear();
+    }
+
+    // Stream mode, answer each line on stdout
+    if (stream) {
+        runStage(stats, "parse_stream", [&] { parseStream(parseTable, STDIN_FILENO); });
+    } else if (wholeFile) {
+        runStage(stats, "parse_whole_file", [&] {
+            ParseCounters counters;
+            int errors = parseWholeFile(parseTable, "input.txt", parseOptions.trace, &counters);
+            if (parseOptions.lineStats) parseOptions.lineStats->push_back({1, errors, false, counters});
+        });
+    } else if (!emitFile.empty()) {
+        // Generator mode, write parser and stop
+        runStage(stats, "emit_parser", [&] { emitParser(parseTable, emitFile, grammarFile); });
+        cout << "\nWrote parser to " << emitFile << endl;
+    } else {
+        // Parse input file
+        string inputFile = "input.txt";
+        parseOptions.grammarHash = grammarHash;
+        runStage(stats, "parse_input", [&] { parseInputFile(parseTable, inputFile, parseOptions); });
+    }
 
-return 0;
+    writeRunStats();
+    return 0;
 }
+#endif
@@ -0,0 +1,441 @@
+// Benchmark for LL(1) pipeline. It make synthetic grammar and input, then time
+// every phase of a3.cpp and print one JSON object per configuration, so results
+// can be kept and compared between versions.
+#define A3_NO_MAIN
+#include "a3.cpp"
+
+#include <chrono>
+#include <random>
+#include <limits>
+
+// Shape of generated grammar and input
+struct BenchConfig {
+    int nonTerminals = 50;      // Non-terminals N0..N(n-1), N0 is start symbol
+    int terminals = 20;         // Terminals t0..t(n-1), plus ( and ) for nesting and f0..f3, r
+    int fanOut = 3;             // Alternatives per non-terminal
+    int leftRecursionDepth = 2; // N0 -> N1, N1 -> N2, ..., back to N0 r (1 mean direct)
+    double epsilonDensity = 0.1; // Chance of non-terminal to have epsilon alternative
+    int tokens = 64;            // Tokens per input line (about)
+    int nestingDepth = 4;       // Most open ( in one line
+    int lines = 1000;           // Input lines
+    unsigned seed = 1;
+    int repeat = 3;             // Run pipeline this many times, keep fastest of each phase
+};
+
+// Make grammar from config. It is LL(1) after left factoring and left recursion
+// removal, so parse time is time of real parsing and not of error recovery:
+//   - alternatives of one non-terminal start with different terminals, except
+//     groups made for left factoring, which differ in second terminal
+//   - every non-terminal in a body is followed by one of FOLLOW_TERMINALS, and
+//     these never start an alternative, so epsilon alternatives have no conflict
+//   - left recursion is chain over N0..N(d-1) in name order (order removeLeftRecursion
+//     use), last one -> N0 r with r used nowhere else. So removal make only last one
+//     directly recursive, and its N' -> r N' | e is decided by r only
+// Every cycle have a terminal, so shortest derivation always end
+const char* const FOLLOW_TERMINALS[] = {"f0", "f1", "f2", "f3"};
+const char* const RECURSION_TERMINAL = "r";
+
+Grammar makeGrammar(const BenchConfig& config) {
+    mt19937 rng(config.seed);
+    auto pick = [&](int n) { return (int)(rng() % (unsigned)n); };
+    auto nonTerminal = [](int i) { return "N" + to_string(i); };
+    auto terminal = [](int i) { return "t" + to_string(i); };
+    auto followTerminal = [&]() { return string(FOLLOW_TERMINALS[pick(size(FOLLOW_TERMINALS))]); };
+
+    Grammar grammar;
+    grammar.startSymbol = nonTerminal(0);
+    int n = max(1, config.nonTerminals);
+    int t = max(2, config.terminals);
+    int fanOut = min(max(1, config.fanOut), t); // Each alternative need its own first terminal
+    int depth = min(config.leftRecursionDepth, n);
+
+    // Different terminals from t0..t(t-1), first count of a shuffle
+    auto distinctTerminals = [&](int count) {
+        vector<int> ids(t);
+        for (int k = 0; k < t; k++) ids[k] = k;
+        for (int k = 0; k < count; k++) swap(ids[k], ids[k + pick(t - k)]);
+        ids.resize(count);
+        return ids;
+    };
+
+    // Chain order is name order, N0 first
+    vector<int> chain(depth), nextInChain(depth, -1);
+    for (int k = 0; k < depth; k++) chain[k] = k;
+    sort(chain.begin(), chain.end(), [&](int a, int b) { return nonTerminal(a) < nonTerminal(b); });
+    for (int k = 0; k + 1 < depth; k++) nextInChain[chain[k]] = chain[k + 1];
+
+    for (int i = 0; i < n; i++) {
+        vector<vector<string>>& alternatives = grammar.productions[nonTerminal(i)];
+
+        // Left recursion chain over first non-terminals, only last one close it
+        if (i < depth && nextInChain[i] != -1) {
+            alternatives.push_back({nonTerminal(nextInChain[i])});
+            continue;
+        }
+        if (i < depth) alternatives.push_back({nonTerminal(0), RECURSION_TERMINAL});
+
+        // Sometimes reuse first terminal of last alternative, so left factoring have work
+        vector<int> leads = distinctTerminals(fanOut);
+        vector<int> group(fanOut);
+        for (int a = 0; a < fanOut; a++) {
+            group[a] = a > 0 && pick(3) == 0 ? group[a - 1] : a;
+        }
+
+        // Body use only later non-terminals off the chain, so no other left recursion
+        int firstBody = max(i + 1, depth);
+        size_t firstOwn = alternatives.size();
+        for (int a = 0; a < fanOut; a++) {
+            vector<string> production = {terminal(leads[group[a]])};
+            int extra = pick(3);
+            for (int k = 0; k < extra; k++) {
+                if (firstBody < n && pick(2) == 0) {
+                    production.push_back(nonTerminal(firstBody + pick(n - firstBody)));
+                    production.push_back(followTerminal());
+                } else {
+                    production.push_back(terminal(pick(t)));
+                }
+            }
+            alternatives.push_back(production);
+        }
+
+        // Alternatives in one group get different second terminal, so factored rest is LL(1)
+        for (int a = 0; a < fanOut;) {
+            int last = a;
+            while (last + 1 < fanOut && group[last + 1] == group[a]) last++;
+            if (last > a) {
+                vector<int> seconds = distinctTerminals(last - a + 1);
+                for (int k = a; k <= last; k++) {
+                    auto& production = alternatives[firstOwn + k];
+                    production.insert(production.begin() + 1, terminal(seconds[k - a]));
+                }
+            }
+            a = last + 1;
+        }
+
+        // Last non-terminal open new nesting level
+        if (i == n - 1 && config.nestingDepth > 0) {
+            alternatives.push_back({"(", nonTerminal(0), ")"});
+        }
+
+        if (pick(1000) < (int)(config.epsilonDensity * 1000)) {
+            alternatives.push_back({"e"});
+        }
+    }
+    return grammar;
+}
+
+// Make input lines by random derivation from start symbol. When line is near
+// token budget, only shortest alternatives are taken, so it finish
+vector<string> makeInput(const Grammar& grammar, const BenchConfig& config) {
+    mt19937 rng(config.seed + 1);
+
+    // Shortest terminal length each non-terminal can give
+    map<string, long> shortest;
+    for (const auto& [lhs, alternatives] : grammar.productions) shortest[lhs] = numeric_limits<int>::max();
+    auto length = [&](const vector<string>& production) {
+        long total = 0;
+        for (const string& symbol : production) {
+            if (symbol == "e") continue;
+            total += isNonTerminalName(symbol) ? shortest[symbol] : 1;
+        }
+        return total;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            for (const auto& production : alternatives) {
+                long l = length(production);
+                if (l < shortest[lhs]) {
+                    shortest[lhs] = l;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Non-terminals which can reach a cycle, only these can make line longer and longer.
+    // Second map is for when nesting is used up, then ( alternatives do not count
+    auto findUnbounded = [&](bool withNesting) {
+        auto usable = [&](const vector<string>& production) { return withNesting || production[0] != "("; };
+        auto reaches = [&](const string& from, auto&& accept) {
+            set<string> seen;
+            vector<string> todo = {from};
+            while (!todo.empty()) {
+                string current = todo.back();
+                todo.pop_back();
+                for (const auto& production : grammar.productions.at(current)) {
+                    if (!usable(production)) continue;
+                    for (const string& symbol : production) {
+                        if (!isNonTerminalName(symbol)) continue;
+                        if (accept(symbol)) return true;
+                        if (seen.insert(symbol).second) todo.push_back(symbol);
+                    }
+                }
+            }
+            return false;
+        };
+        set<string> onCycle;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            if (reaches(lhs, [&](const string& s) { return s == lhs; })) onCycle.insert(lhs);
+        }
+        map<string, bool> unbounded;
+        for (const auto& [lhs, alternatives] : grammar.productions) {
+            unbounded[lhs] = onCycle.count(lhs) || reaches(lhs, [&](const string& s) { return onCycle.count(s) > 0; });
+        }
+        return unbounded;
+    };
+    map<string, bool> unboundedNesting = findUnbounded(true), unboundedFlat = findUnbounded(false);
+    auto grows = [&](const vector<string>& production, bool canNest) {
+        map<string, bool>& unbounded = canNest ? unboundedNesting : unboundedFlat;
+        return any_of(production.begin(), production.end(), [&](const string& s) {
+            return isNonTerminalName(s) && unbounded[s];
+        });
+    };
+
+    vector<string> lines;
+    for (int lineNo = 0; lineNo < config.lines; lineNo++) {
+        string line;
+        long emitted = 0, pending = shortest[grammar.startSymbol];
+        int open = 0; // Current nesting depth
+        vector<string> work = {grammar.startSymbol}; // Symbols still to derive, top is back
+
+        while (!work.empty()) {
+            string symbol = move(work.back());
+            work.pop_back();
+
+            if (!isNonTerminalName(symbol)) {
+                if (symbol == "e") continue;
+                if (symbol == "(") open++;
+                if (symbol == ")") open--;
+                if (!line.empty()) line += ' ';
+                line += symbol;
+                emitted++;
+                pending--;
+                continue;
+            }
+
+            const auto& alternatives = grammar.productions.at(symbol);
+            pending -= shortest[symbol];
+            // Under budget, take alternatives which can still grow
+            vector<int> allowed, growing;
+            for (int a = 0; a < (int)alternatives.size(); a++) {
+                if (alternatives[a][0] == "(" && open >= config.nestingDepth) continue;
+                if (emitted + pending + length(alternatives[a]) > config.tokens) continue;
+                allowed.push_back(a);
+                if (grows(alternatives[a], open < config.nestingDepth)) growing.push_back(a);
+            }
+            int choice = -1;
+            if (!growing.empty()) {
+                choice = growing[rng() % growing.size()];
+            } else if (!allowed.empty()) {
+                choice = allowed[rng() % allowed.size()];
+            } else {
+                // Over budget, take shortest one
+                for (int a = 0; a < (int)alternatives.size(); a++) {
+                    if (choice == -1 || length(alternatives[a]) < length(alternatives[choice])) choice = a;
+                }
+            }
+
+            const vector<string>& production = alternatives[choice];
+            pending += length(production);
+            for (auto it = production.rbegin(); it != production.rend(); ++it) work.push_back(*it);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+void writeGrammarFile(const Grammar& grammar, const string& filename) {
+    ofstream out(filename);
+    // Start symbol must be first line
+    vector<string> order = {grammar.startSymbol};
+    for (const auto& [lhs, alternatives] : grammar.productions) {
+        if (lhs != grammar.startSymbol) order.push_back(lhs);
+    }
+    for (const string& lhs : order) {
+        out << lhs << " ->";
+        const auto& alternatives = grammar.productions.at(lhs);
+        for (size_t a = 0; a < alternatives.size(); a++) {
+            if (a > 0) out << " |";
+            for (const string& symbol : alternatives[a]) out << ' ' << symbol;
+        }
+        out << '\n';
+    }
+}
+
+void writeInputFile(const vector<string>& lines, const string& filename) {
+    ofstream out(filename);
+    for (const string& line : lines) out << line << '\n';
+}
+
+// Time of each phase in milliseconds
+struct PhaseTimes {
+    double leftFactoring = 0, leftRecursion = 0, first = 0, follow = 0, table = 0, parse = 0;
+
+    void keepFastest(const PhaseTimes& other) {
+        leftFactoring = min(leftFactoring, other.leftFactoring);
+        leftRecursion = min(leftRecursion, other.leftRecursion);
+        first = min(first, other.first);
+        follow = min(follow, other.follow);
+        table = min(table, other.table);
+        parse = min(parse, other.parse);
+    }
+};
+
+// Run fn and give its time in milliseconds
+template <class Fn>
+double timeIt(Fn&& fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Run one configuration and print its JSON. False if table had conflicts, then
+// parse time is time of error recovery and result must not be used
+bool runBenchmark(const BenchConfig& config) {
+    Grammar grammar = makeGrammar(config);
+    vector<string> input = makeInput(grammar, config);
+    size_t tokenCount = 0;
+    for (const string& line : input) tokenCount += count(line.begin(), line.end(), ' ') + (line.empty() ? 0 : 1);
+
+    // Pipeline print a lot, turn cout off while timing. Warnings go to cerr then, turn it
+    // off too, real conflicts are counted in table. Parse is timed without trace
+    TraceOutput noTrace(nullptr, TraceMode::None);
+    cout.setstate(ios::badbit);
+    cerr.setstate(ios::badbit);
+
+    PhaseTimes best;
+    size_t finalProductions = 0, symbolCount = 0;
+    int errors = 0, conflicts = 0;
+    for (int r = 0; r < max(1, config.repeat); r++) {
+        PhaseTimes times;
+        Grammar finalGrammar = grammar; // Passes change it in place, copy is not timed
+        SymbolTable symbols;
+        GrammarSets sets;
+        ParseTable table;
+
+        times.leftFactoring = timeIt([&] { applyLeftFactoring(finalGrammar); });
+        times.leftRecursion = timeIt([&] { removeLeftRecursion(finalGrammar); });
+        times.first = timeIt([&] {
+            symbols = buildSymbolTable(finalGrammar);
+            sets = computeFirstSets(finalGrammar, symbols);
+        });
+        times.follow = timeIt([&] { sets.follow = computeFollowSets(finalGrammar, symbols, sets); });
+        times.table = timeIt([&] { table = constructLL1Table(finalGrammar, symbols, sets); });
+        errors = 0;
+        times.parse = timeIt([&] {
+            for (const string& line : input) errors += parseInput(table, line, noTrace);
+        });
+
+        if (r == 0) best = times;
+        else best.keepFastest(times);
+        finalProductions = table.productionCount();
+        conflicts = table.conflicts;
+        symbolCount = symbols.names.size();
+    }
+
+    cout.clear();
+    cerr.clear();
+
+    cout << fixed << setprecision(3);
+    cout << "{\"benchmark\":\"ll1_pipeline\""
+         << ",\"config\":{\"nonterminals\":" << config.nonTerminals
+         << ",\"terminals\":" << config.terminals
+         << ",\"fanout\":" << config.fanOut
+         << ",\"left_recursion_depth\":" << config.leftRecursionDepth
+         << ",\"epsilon_density\":" << config.epsilonDensity
+         << ",\"tokens\":" << config.tokens
+         << ",\"nesting_depth\":" << config.nestingDepth
+         << ",\"lines\":" << config.lines
+         << ",\"seed\":" << config.seed
+         << ",\"repeat\":" << config.repeat << "}"
+         << ",\"grammar\":{\"productions\":" << finalProductions << ",\"symbols\":" << symbolCount
+         << ",\"conflicts\":" << conflicts << "}"
+         << ",\"phases_ms\":{\"left_factoring\":" << best.leftFactoring
+         << ",\"left_recursion\":" << best.leftRecursion
+         << ",\"first\":" << best.first
+         << ",\"follow\":" << best.follow
+         << ",\"table\":" << best.table
+         << ",\"parse\":" << best.parse << "}"
+         << ",\"parse\":{\"lines\":" << input.size()
+         << ",\"tokens\":" << tokenCount
+         << ",\"errors\":" << errors << "}}" << endl;
+    cout << defaultfloat;
+
+    if (conflicts != 0) {
+        cerr << "Error: Generated grammar is not LL(1), " << conflicts << " conflict(s) (seed " << config.seed << ")"
+             << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bool single = false; // Any shape option given, so run only that one
+    string grammarOut, inputOut;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--nonterminals" && hasValue) { config.nonTerminals = stoi(argv[++i]); single = true; }
+        else if (arg == "--terminals" && hasValue) { config.terminals = stoi(argv[++i]); single = true; }
+        else if (arg == "--fanout" && hasValue) { config.fanOut = stoi(argv[++i]); single = true; }
+        else if (arg == "--left-recursion" && hasValue) { config.leftRecursionDepth = stoi(argv[++i]); single = true; }
+        else if (arg == "--epsilon" && hasValue) { config.epsilonDensity = stod(argv[++i]); single = true; }
+        else if (arg == "--tokens" && hasValue) { config.tokens = stoi(argv[++i]); single = true; }
+        else if (arg == "--nesting" && hasValue) { config.nestingDepth = stoi(argv[++i]); single = true; }
+        else if (arg == "--lines" && hasValue) { config.lines = stoi(argv[++i]); single = true; }
+        else if (arg == "--seed" && hasValue) config.seed = stoul(argv[++i]);
+        else if (arg == "--repeat" && hasValue) config.repeat = stoi(argv[++i]);
+        else if (arg == "--write-grammar" && hasValue) { grammarOut = argv[++i]; single = true; }
+        else if (arg == "--write-input" && hasValue) { inputOut = argv[++i]; single = true; }
+        else {
+            cerr << "Usage: " << argv[0] << " [--nonterminals N] [--terminals N] [--fanout N] [--left-recursion N]"
+                 << " [--epsilon P] [--tokens N] [--nesting N] [--lines N] [--seed N] [--repeat N]"
+                 << " [--write-grammar FILE] [--write-input FILE]" << endl;
+            return 1;
+        }
+    }
+
+    // Write generated files, so same case can run with a3 too
+    if (!grammarOut.empty() || !inputOut.empty()) {
+        Grammar grammar = makeGrammar(config);
+        if (!grammarOut.empty()) writeGrammarFile(grammar, grammarOut);
+        if (!inputOut.empty()) writeInputFile(makeInput(grammar, config), inputOut);
+        return 0;
+    }
+
+    if (single) return runBenchmark(config) ? 0 : 1;
+
+    // Default sweep: grow grammar size, then input size, then hard shapes
+    vector<BenchConfig> sweep;
+    for (int n : {10, 100, 1000}) {
+        BenchConfig c = config;
+        c.nonTerminals = n;
+        c.terminals = max(10, n / 2);
+        sweep.push_back(c);
+    }
+    for (int tokens : {16, 256, 4096}) {
+        BenchConfig c = config;
+        c.tokens = tokens;
+        c.lines = config.lines * 64 / max(64, tokens); // Keep total tokens near same
+        sweep.push_back(c);
+    }
+    {
+        BenchConfig c = config;
+        c.leftRecursionDepth = 20;
+        c.fanOut = 6;
+        sweep.push_back(c);
+    }
+    {
+        BenchConfig c = config;
+        c.epsilonDensity = 0.5;
+        c.nestingDepth = 32;
+        c.tokens = 512;
+        sweep.push_back(c);
+    }
+    bool ok = true;
+    for (const BenchConfig& c : sweep) ok = runBenchmark(c) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+g++ -std=c++20 -O2 -pthread bench.cpp -o bench
+./bench "$@"
+rm bench
\ No newline at end of file
@@ -1,3 +1,3 @@
-g++ a3.cpp
-./a.out
+g++ -std=c++20 -pthread a3.cpp
+./a.out "$@"
 rm a.out
\ No newline at end of file
@@ -0,0 +1,53 @@
+# Broken input.txt.parsecache must be a cache miss: --incremental --tree give same
+# result as a run without cache, and never crash. Run from this folder
+dir=$(mktemp -d)
+g++ -std=c++20 -O2 -pthread a3.cpp -o $dir/a3 || exit 1
+cd $dir
+printf 'E -> E + T | T\nT -> T * F | F\nF -> ( E ) | x\n' > grammar.txt
+printf '( x ) + x * x\n' > input.txt # One good line, so its tree is first in cache
+cache=input.txt.parsecache
+failed=0
+ulimit -f 100000 # Cycle in tree make endless output, stop it
+
+# Write bytes (printf escapes) at offset of cache file
+poke() {
+    printf "$2" | dd of=$cache bs=1 seek=$1 conv=notrunc 2>/dev/null
+}
+
+# File: 24 byte header (count at 16), then per line 8 byte hash, 4 byte errors,
+# 4 byte node count, then 20 byte nodes (symbol, firstChild, childCount, tokenStart,
+# tokenLength). So node count is at 36, root at 40 and second node at 60.
+# Broken file must give same output as fresh run. Broken token of a tree is found
+# when line is used, then line is parsed again, so it must not say (cached)
+check() {
+    rm -f $cache
+    ./a3 --incremental --tree > fresh.out 2>&1
+    poke $2 "$3"
+    timeout 10 ./a3 --incremental --tree > broken.out 2>&1
+    rc=$?
+    if [ $1 = file ]; then
+        cmp -s fresh.out broken.out
+    else
+        ! grep -q '(cached)' broken.out && [ "$(grep 'Total errors' broken.out)" = "$(grep 'Total errors' fresh.out)" ]
+    fi
+    same=$?
+    if [ $rc -ne 0 ] || [ $same -ne 0 ]; then
+        echo "FAIL: $4 (rc=$rc)"
+        failed=1
+    else
+        echo "ok: $4"
+    fi
+}
+
+check file 44 '\240\206\001\000' "root firstChild 100000"
+check file 36 '\000\000\000\360' "node count 0xF0000000"
+check file 16 '\377\377\377\377\377\377\377\377' "line count 2^64-1"
+check file 40 '\017\047\000\000' "root symbol 9999"
+check file 44 '\000\000\000\000' "root is its own child"
+check file 48 '\377\377\377\377' "root child count -1"
+check file 64 '\001\000\000\000\001\000\000\000' "second node child of itself"
+check line 72 '\000\000\000\000\377\377\377\377' "second node token out of line"
+
+cd - > /dev/null
+rm -rf $dir
+exit $failed